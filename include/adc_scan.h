@@ -0,0 +1,22 @@
+#ifndef ADC_SCAN_H
+#define ADC_SCAN_H
+
+#include <Arduino.h>
+
+// Free running pot scanner. The ADC conversion complete interrupt walks the
+// channel list below, averages ADC_OVERSAMPLE conversions per channel and
+// stores the result in a cache that adcRead() returns from, so reading a pot
+// in loop() no longer waits ~110us for a conversion.
+//
+// The first conversion after switching channels is thrown away to let the
+// sample and hold settle, and a cached value only moves once the new average
+// is more than ADC_HYSTERESIS away, so a resting pot reads back the same value
+// every time instead of flickering between neighbours.
+#define ADC_OVERSAMPLE_SHIFT 2
+#define ADC_OVERSAMPLE       (1 << ADC_OVERSAMPLE_SHIFT)
+#define ADC_HYSTERESIS       2
+
+void adcBegin();
+uint16_t adcRead(uint8_t channel);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef BANK_H
+#define BANK_H
+
+#include <Arduino.h>
+
+// Step storage: one packed record per step, indexed by step number - 1.
+// Phase increments are kept as 16 bit, decays as 8 bit, exactly as the
+// synth engine consumes them. The rest says how the step plays; all of it
+// zero is a plain step that plays every time for its whole length, which is
+// what a step saved before these existed comes back as.
+struct Step {
+  uint16_t syncPhaseInc;
+  uint16_t grainPhaseInc;
+  uint16_t grain2PhaseInc;
+  uint8_t grainDecay;
+  uint8_t grain2Decay;
+  uint8_t rest : 1;     // silent
+  uint8_t tie : 1;      // no new note, the one before takes on this step's sound
+  uint8_t ratchet : 2;  // extra hits spread evenly over the step, 0-3
+  uint8_t skip : 4;     // chance in 16 of the step being skipped
+  uint8_t length : 4;   // gate of every hit in 16ths of it, 0 for all of it
+  uint8_t slide : 4;    // glide into the step over 16ths of it, 0 for none
+  uint8_t grainWave : 4;  // wavetable of each grain (wavetables.h), 0 the triangle
+  uint8_t grain2Wave : 4;
+  uint8_t filter : 2;     // bus filter mode (bus_filter.h), 0 for off
+  uint8_t cutoff : 6;     // and its cutoff, resonance
+  uint8_t resonance : 4;
+};
+
+#define NUMSTEPS 16
+
+// A pattern: its steps plus the settings that go with it
+struct Pattern {
+  Step steps[NUMSTEPS];
+  uint8_t tempo;
+  uint8_t length;       // steps played, 1..NUMSTEPS
+};
+
+// A song: a chain of up to SONG_ENTRIES patterns played in order, each for
+// a number of bars and, where set, at its own tempo and length rather than
+// the pattern's. All of an entry zero is pattern 1 once as it is saved.
+#define SONG_ENTRIES 32
+
+struct SongEntry {
+  uint8_t pattern : 3;
+  uint8_t repeats : 5;  // bars played, less one
+  uint8_t tempo;        // 0 for the pattern's
+  uint8_t length;       // steps, 0 for the pattern's
+};
+
+struct Song {
+  SongEntry entry[SONG_ENTRIES];
+  uint8_t count;        // entries in the chain, 0 for no song
+};
+
+// Pattern bank in the EEPROM. The EEPROM is a ring of 18 byte slots, each
+// holding one record: a single step of one pattern or that pattern's
+// settings, stamped with a 24 bit sequence number and a CRC. Saving a step
+// appends a new record at the head of the ring, so only what changed gets
+// written and the wear goes round all the slots. Slots still holding the
+// latest copy of something are skipped, and a record torn by a power cut
+// fails its CRC, leaving the previous copy in charge. bankBegin() scans the
+// ring once and keeps the slot of the newest record for everything in RAM.
+//
+// An EEPROM byte takes 3.4ms to write, so nothing here waits for one:
+// bankSave() queues the record and bankLoad() only starts a load, and
+// bankTask(), called every pass of loop(), writes a byte or reads a record
+// whenever the EEPROM is free.
+//
+// The song is saved the same way, in SONG_PARTS records of SONG_PART_ENTRIES
+// entries each, so changing an entry rewrites only its part.
+#define BANK_PATTERNS   8
+#define BANK_SETTINGS   NUMSTEPS    // record index of the pattern settings
+#define BANK_QUEUE      4           // records waiting to be written
+
+#define SONG_PART_ENTRIES 4
+#define SONG_PARTS      (SONG_ENTRIES / SONG_PART_ENTRIES)
+
+void bankBegin();
+bool bankSave(uint8_t pattern, uint8_t index, const Pattern &p);
+bool bankSaveSong(uint8_t part, const Song &song);
+void bankLoad(uint8_t pattern, Pattern *p);
+void bankLoadSong(Song &song);
+bool bankLoading();
+void bankTask();
+
+#endif
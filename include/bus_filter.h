@@ -0,0 +1,96 @@
+#ifndef BUS_FILTER_H
+#define BUS_FILTER_H
+
+#include <stdint.h>
+
+#include "progmem_compat.h"
+#include "fixmath.h"
+
+// Resonant filter on the output bus, between the voice mix and the delay,
+// portable like grain_engine.h so the offline renderer runs the same code.
+//
+// It is a Chamberlin state variable filter, two integrators in a loop:
+//   low  += f * band
+//   high  = in - low - q * band
+//   band += f * high
+// giving the low, band and high pass outputs of one 2 pole (12dB/octave)
+// filter at once; the mode picks which one is heard. f = 2 sin(pi fc / fs)
+// sets the cutoff and q = 1/Q the damping. Both come ready made from tables
+// in flash, worked out by the compiler (bus_filter.cpp), so the sequencer
+// looks them up once per step and the interrupt never sees a sine.
+//
+// Everything is 16 bit fixed point. f and q are Q8, the sample goes in
+// FILTER_SHIFT bits up, which leaves 18dB of headroom for the resonance,
+// and the states saturate instead of wrapping when a high Q runs them
+// into the rails. The cutoffs stop at 5kHz, where f is still below 1 and
+// the loop stays stable at any Q.
+//
+// Per sample, from the instruction count: three 9 cycle multiplies
+// (mulS16U8), four 4 cycle saturating adds, about 20 cycles of state loads
+// and stores and 20 more to scale the sample in and clip it back out to
+// 8 bits, around 85 cycles or a sixth of a sample. A bus with the filter
+// off pays for a single test. The isrbench pattern runs it on every step.
+#define FILTER_OFF        0
+#define FILTER_LOW        1
+#define FILTER_BAND       2
+#define FILTER_HIGH       3
+#define FILTER_MODES      4
+
+#define FILTER_CUTOFFS    64    // a tenth of an octave apart, 78Hz to 5kHz
+#define FILTER_RESONANCES 16    // Q from 1 to 16
+#define FILTER_SHIFT      5
+
+struct FilterTables {
+  uint8_t f[FILTER_CUTOFFS];
+  uint8_t q[FILTER_RESONANCES];
+
+  constexpr FilterTables();
+};
+
+extern const FilterTables filterTables PROGMEM;
+
+// What the filter is set to, handed to the interrupt with a step
+struct FilterParams {
+  uint8_t mode;
+  uint8_t f;
+  uint8_t q;
+};
+
+inline void filterParams(FilterParams &p, uint8_t mode, uint8_t cutoff, uint8_t resonance) {
+  p.mode = mode & (FILTER_MODES - 1);
+  p.f = pgm_read_byte(&filterTables.f[cutoff & (FILTER_CUTOFFS - 1)]);
+  p.q = pgm_read_byte(&filterTables.q[resonance & (FILTER_RESONANCES - 1)]);
+}
+
+struct BusFilter {
+  int16_t low;
+  int16_t band;
+  uint8_t mode;
+  uint8_t f;
+  uint8_t q;
+
+  // A filter switched on starts from silence rather than from wherever it
+  // was left
+  inline void set(const FilterParams &p) {
+    if (p.mode != mode) low = band = 0;
+    mode = p.mode;
+    f = p.f;
+    q = p.q;
+  }
+
+  inline uint8_t process(uint8_t in) {
+    if (mode == FILTER_OFF) return in;
+    int16_t x = ((int16_t)in - 128) << FILTER_SHIFT;
+    low = satAddS16(low, mulS16U8(band, f));
+    int16_t high = satSubS16(satSubS16(x, low), mulS16U8(band, q));
+    band = satAddS16(band, mulS16U8(high, f));
+
+    int16_t y = (mode == FILTER_LOW) ? low : (mode == FILTER_BAND) ? band : high;
+    y >>= FILTER_SHIFT;
+    if (y > 127) y = 127;
+    if (y < -128) y = -128;
+    return y + 128;
+  }
+};
+
+#endif
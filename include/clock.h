@@ -0,0 +1,95 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <Arduino.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "sample_rate.h"
+
+// Sequencer clock. The audio interrupt calls clockTick() once per sample and
+// bumps stepsRaised whenever a step is due; loop() catches its own counter up
+// to it. Each counter has a single writer, so neither side needs to mask
+// interrupts to hand a step over.
+//
+// The PWM makes F_CPU/510 samples per second (sample_rate.h), so one 1/16
+// step lasts F_CPU*15/(510*bpm) samples. That rarely divides evenly: the
+// whole part reloads the countdown and the remainder is carried Bresenham
+// style, adding one sample whenever it adds up to a whole one.
+
+// Tempo range of the tempo pot, and of anything else that sets one. Below
+// 8 BPM a step no longer fits the 16 bit sample count, setTempo() refuses it.
+#define TEMPO_MIN 60
+#define TEMPO_MAX 180
+
+// External sync sources, whichever is plugged in:
+//  - clock pulses on pin 11, two per quarter note (Korg/Volca style sync), so
+//    every pulse plays a step and the step in between is interpolated
+//  - 24 PPQN MIDI clock on the MIDI input (midi.h), one step every 6 ticks
+#define SYNC_PIN              11
+#define SYNC_STEPS_PER_PULSE  2
+#define MIDI_TICKS_PER_STEP   6
+
+extern volatile uint8_t stepsRaised;
+extern volatile bool clockRestart;
+
+extern bool extSync;
+extern uint16_t stepCountdown;
+extern uint16_t stepSamples;
+extern uint32_t stepRemainder;
+extern uint32_t stepDivisor;
+extern uint32_t stepError;
+extern uint8_t extStepsLeft;
+extern uint16_t extStepSamples;
+extern uint16_t extStepLatched;
+extern volatile uint8_t extEdges;
+extern volatile uint8_t extEdgeSteps;
+extern uint8_t extEdgesSeen;
+
+void clockBegin();
+bool setTempo(int bpm);
+void setClockSource(bool external);
+int externalTempo();
+void clockMidi(uint8_t data);
+
+// An external clock edge came in: play its step now and schedule the
+// interpolated ones. Steps still pending from the last edge mean the source
+// sped up, so those are played right away to stay in phase.
+//
+// The edge interrupts only count edges and never touch the countdown, because
+// the render interrupt runs with interrupts enabled and could be cut short in
+// the middle of it. For the same reason the 16 bit step length they write is
+// copied with interrupts off.
+inline void clockEdge() {
+  uint8_t sreg = SREG;
+  cli();
+  extStepLatched = extStepSamples;
+  SREG = sreg;
+  extEdgesSeen++;
+  stepsRaised += extStepsLeft + 1;
+  extStepsLeft = extEdgeSteps - 1;
+  stepCountdown = extStepsLeft ? extStepLatched : 0;
+}
+
+// Called once per sample from the audio interrupt
+inline void clockTick() {
+  if (extEdges != extEdgesSeen) clockEdge();
+  if (stepCountdown && --stepCountdown == 0) {
+    if (!extSync) {
+      stepCountdown = stepSamples;
+      stepError += stepRemainder;
+      if (stepError >= stepDivisor) {
+        stepError -= stepDivisor;
+        stepCountdown++;
+      }
+      stepsRaised++;
+    }
+    else if (extStepsLeft) {
+      // Interpolated step between two external clock pulses
+      stepsRaised++;
+      if (--extStepsLeft) stepCountdown = extStepLatched;
+    }
+  }
+}
+
+#endif
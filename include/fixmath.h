@@ -0,0 +1,117 @@
+#ifndef FIXMATH_H
+#define FIXMATH_H
+
+#include <stdint.h>
+
+// Saturating and widening integer helpers for the synth parameters, portable
+// like grain_engine.h. The parameters are unsigned fields that take signed
+// offsets (the live tweaks, glides), and a plain add wraps: a decay pushed
+// below 0 comes back as 250-odd and kills the grain, a sync increment pushed
+// below 0 becomes a huge one. These clamp to the ends of the field instead.
+//
+// The adds work on the carry of the plain sum, so they cost a compare and a
+// branch over it and no wider arithmetic. On the AVR mulU8() is the single
+// hardware multiply, which gcc won't always pick when one side is a shifted
+// 16 bit value.
+//
+// test/test_fixmath checks every one of them against int32 arithmetic: the C
+// on the PC, the assembly as a model on the PC and as itself under simavr.
+// satAddU16 and satAddU8 stay in C, gcc turns their carry test into the
+// add, adc and brcc an assembly version would be.
+
+// a + b, clamped to 0..65535
+inline uint16_t satAddU16(uint16_t a, int16_t b) {
+  uint16_t r = a + (uint16_t)b;
+  if (b >= 0) return (r < a) ? 0xFFFF : r;
+  return (r > a) ? 0 : r;
+}
+
+// a + b, clamped to 0..255
+inline uint8_t satAddU8(uint8_t a, int8_t b) {
+  uint8_t r = a + (uint8_t)b;
+  if (b >= 0) return (r < a) ? 0xFF : r;
+  return (r > a) ? 0 : r;
+}
+
+// a - b, stopping at 0
+inline uint16_t satSubU16(uint16_t a, uint16_t b) {
+  return (b > a) ? 0 : a - b;
+}
+
+// a + b and a - b, clamped to -32768..32767. Used for the filter states
+// (bus_filter.h), where a wrap would flip a full swing into the opposite
+// one. On the AVR the overflow flag of the add decides, 4 cycles when it
+// doesn't fire.
+inline int16_t satAddS16(int16_t a, int16_t b) {
+#ifdef __AVR__
+  asm("add %A0, %A1\n\t"
+      "adc %B0, %B1\n\t"
+      "brvc 1f\n\t"
+      "ldi %A0, 0xFF\n\t"     // ldi leaves N alone: set means it went over the top
+      "ldi %B0, 0x7F\n\t"
+      "brmi 1f\n\t"
+      "ldi %A0, 0x00\n\t"
+      "ldi %B0, 0x80\n"
+      "1:"
+      : "+d" (a) : "r" (b));
+  return a;
+#else
+  int32_t r = (int32_t)a + b;
+  return (r > 32767) ? 32767 : (r < -32768) ? -32768 : r;
+#endif
+}
+
+inline int16_t satSubS16(int16_t a, int16_t b) {
+#ifdef __AVR__
+  asm("sub %A0, %A1\n\t"
+      "sbc %B0, %B1\n\t"
+      "brvc 1f\n\t"
+      "ldi %A0, 0xFF\n\t"
+      "ldi %B0, 0x7F\n\t"
+      "brmi 1f\n\t"
+      "ldi %A0, 0x00\n\t"
+      "ldi %B0, 0x80\n"
+      "1:"
+      : "+d" (a) : "r" (b));
+  return a;
+#else
+  int32_t r = (int32_t)a - b;
+  return (r > 32767) ? 32767 : (r < -32768) ? -32768 : r;
+#endif
+}
+
+// 8 x 8 bit to 16 bit product
+inline uint16_t mulU8(uint8_t a, uint8_t b) {
+#ifdef __AVR__
+  uint16_t r;
+  asm("mul %1, %2\n\t"
+      "movw %0, r0\n\t"
+      "clr r1"
+      : "=r" (r) : "r" (a), "r" (b));
+  return r;
+#else
+  return (uint16_t)a * b;
+#endif
+}
+
+// (a * b) >> 8 of a signed 16 bit value and an unsigned Q8 gain, two
+// hardware multiplies and 9 cycles on the AVR where gcc would call its 32
+// bit multiply
+inline int16_t mulS16U8(int16_t a, uint8_t b) {
+#ifdef __AVR__
+  int16_t r;
+  asm("mul %A1, %2\n\t"         // low byte of a times b, only its top byte counts
+      "mov %A0, r1\n\t"
+      "mulsu %B1, %2\n\t"       // high byte of a, signed, times b
+      "add %A0, r0\n\t"
+      "mov %B0, r1\n\t"
+      "clr r1\n\t"              // the zero register, without touching the carry
+      "adc %B0, r1"
+      : "=&r" (r) : "a" (a), "a" (b));
+  return r;
+#else
+  return ((int32_t)a * b) >> 8;
+#endif
+}
+
+#endif
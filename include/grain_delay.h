@@ -0,0 +1,143 @@
+#ifndef GRAIN_DELAY_H
+#define GRAIN_DELAY_H
+
+#include <stdint.h>
+
+#include "progmem_compat.h"
+
+// Tempo synced delay for the grain engine, portable like grain_engine.h so the
+// offline renderer runs the same code as the board.
+//
+// The delay line holds 1 << BITS slots. To stretch a few KB of RAM into half a
+// second or more, every slot holds the average of DECIMATE output samples
+// (the read side is interpolated back up) and with PACK 4 a slot is a 4 bit
+// logarithmic code, two to a byte, which keeps quiet tails from vanishing
+// into the bottom step the way plain 4 bit samples would. PACK 8 stores the
+// averaged samples as they are.
+//
+// TAPS (1 to 3) reads are spread evenly over the delay time, so 3 taps on a
+// 3 step delay repeat on every step. The last tap is the loudest and the only
+// one fed back. Feedback and mix are crossfades rather than sums, so nothing
+// ever clips and the repeats can't run away however high feedback goes.
+//
+// The buffer is handed in with begin(): an array in internal RAM, or the
+// external RAM on the Mega's XMEM bus (see DELAY_XMEM in main.cpp).
+
+#ifndef DELAY_BITS
+#ifdef DELAY_XMEM
+#define DELAY_BITS      15    // 32KB of external RAM, about 1 second
+#define DELAY_PACK      8
+#define DELAY_DECIMATE  1
+#else
+#define DELAY_BITS      12    // 2KB of internal RAM, about half a second
+#define DELAY_PACK      4
+#define DELAY_DECIMATE  4
+#endif
+#endif
+#ifndef DELAY_TAPS
+#define DELAY_TAPS      2
+#endif
+
+#define DELAY_BYTES (((uint32_t)1 << DELAY_BITS) * DELAY_PACK / 8)
+
+// Slot codes for PACK 4: levels about 3dB apart, and the thresholds halfway
+// between them that delayCompress() searches. Both live in flash on the AVR.
+static const uint8_t delayLevel[16] PROGMEM = {
+  0, 2, 4, 7, 11, 16, 23, 32, 44, 60, 80, 106, 138, 176, 218, 255
+};
+static const uint8_t delayThreshold[16] PROGMEM = {
+  0, 1, 3, 6, 9, 14, 20, 28, 38, 52, 70, 93, 122, 157, 197, 237
+};
+
+inline uint8_t delayExpand(uint8_t code) {
+  return pgm_read_byte(&delayLevel[code]);
+}
+
+inline uint8_t delayCompress(uint8_t v) {
+  uint8_t code = 0;
+  for (uint8_t step = 8; step; step >>= 1) {
+    if (v >= pgm_read_byte(&delayThreshold[code + step])) code += step;
+  }
+  return code;
+}
+
+template <uint8_t BITS, uint8_t PACK = 8, uint8_t DECIMATE = 1, uint8_t TAPS = 1>
+struct GrainDelay {
+  static_assert(BITS >= 2 && BITS <= 15, "delay line of 4 to 32768 slots");
+  static_assert(PACK == 4 || PACK == 8, "slots are 4 or 8 bits");
+  static_assert(DECIMATE && DECIMATE <= 16 && !(DECIMATE & (DECIMATE - 1)),
+                "DECIMATE must be a power of two, at most 16");
+  static_assert(TAPS >= 1 && TAPS <= 3, "1 to 3 taps");
+
+  static const uint16_t SLOTS = (uint16_t)1 << BITS;
+  static const uint16_t MASK = SLOTS - 1;
+
+  uint8_t *buffer;
+  uint16_t write;         // slot written next
+  uint16_t tap[TAPS];     // tap distances in slots, the last one is the delay time
+  uint8_t feedback;       // 0 writes the input only, 255 only the last tap
+  uint8_t mix;            // 0 dry .. 255 wet
+  uint8_t phase;          // samples averaged into the slot so far
+  uint16_t sum;
+  uint8_t wetFrom, wetTo; // tap output of the last two slots, interpolated
+
+  void begin(uint8_t *ram) {
+    buffer = ram;
+    for (uint32_t i = 0; i < (uint32_t)SLOTS * PACK / 8; i++) buffer[i] = 0;
+    write = 0;
+    phase = 0;
+    sum = 0;
+    wetFrom = wetTo = 0;
+    setTime(SLOTS * DECIMATE / 2);
+  }
+
+  // Delay time in output samples. A time too long for the buffer is halved
+  // until it fits, so a synced delay stays on the beat.
+  void setTime(uint32_t samples) {
+    uint32_t slots = samples / DECIMATE;
+    while (slots >= SLOTS) slots >>= 1;
+    if (slots == 0) slots = 1;
+    for (uint8_t k = 0; k < TAPS; k++) {
+      uint16_t d = slots * (k + 1) / TAPS;
+      tap[k] = d ? d : 1;
+    }
+  }
+
+  inline uint8_t read(uint16_t i) const {
+    i &= MASK;
+    if (PACK == 8) return buffer[i];
+    uint8_t b = buffer[i >> 1];
+    return delayExpand((i & 1) ? b >> 4 : b & 0x0f);
+  }
+
+  inline void store(uint16_t i, uint8_t v) {
+    if (PACK == 8) {
+      buffer[i] = v;
+      return;
+    }
+    uint8_t *p = &buffer[i >> 1];
+    uint8_t code = delayCompress(v);
+    *p = (i & 1) ? (*p & 0x0f) | (code << 4) : (*p & 0xf0) | code;
+  }
+
+  inline uint8_t process(uint8_t in) {
+    sum += in;
+    if (++phase == DECIMATE) {
+      phase = 0;
+      uint8_t last = read(write - tap[TAPS - 1]);
+      uint16_t wet = last;
+      if (TAPS == 2) wet = (wet + read(write - tap[0])) >> 1;
+      if (TAPS == 3) wet = (2 * wet + read(write - tap[0]) + read(write - tap[1])) >> 2;
+      uint8_t slot = sum / DECIMATE;
+      sum = 0;
+      store(write, (slot * (uint16_t)(255 - feedback) + last * (uint16_t)feedback) >> 8);
+      write = (write + 1) & MASK;
+      wetFrom = wetTo;
+      wetTo = wet;
+    }
+    uint8_t wet = wetFrom + (int16_t)(wetTo - wetFrom) * phase / DECIMATE;
+    return (in * (uint16_t)(255 - mix) + wet * (uint16_t)mix) >> 8;
+  }
+};
+
+#endif
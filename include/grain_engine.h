@@ -0,0 +1,316 @@
+#ifndef GRAIN_ENGINE_H
+#define GRAIN_ENGINE_H
+
+#include <stdint.h>
+
+#include "fixmath.h"
+#include "wavetables.h"
+
+// The Auduino grain voice, free of AVR registers and Arduino calls so the very
+// same code runs in the PWM interrupt on the board and in the offline renderer
+// (src/native) on a PC.
+//
+// A sync oscillator restarts two grains every time it wraps. Each grain is a
+// wave at its own frequency, read from one of the tables in wavetables.h (the
+// triangle of the original sketch by default), whose amplitude decays
+// exponentially until the next restart. All of it is 16 bit phase accumulators, one sample
+// per call.
+//
+// GrainEngine runs VOICES of these side by side. Every step triggers the next
+// voice round robin while the one that played before fades out, so tails of
+// consecutive steps overlap. A step can also glide into its sound, hit its
+// voice again (ratchets) and release it early; the sequencer decides when.
+// The voice count is fixed at compile time
+// (GRAIN_VOICES) because every voice costs about 70 cycles per sample in the
+// PWM interrupt; the isrbench target shows what fits.
+
+#ifndef GRAIN_VOICES
+#define GRAIN_VOICES 2
+#endif
+
+// Level lost every GRAIN_CONTROL_RATE samples by a voice that is fading out,
+// 3 gives tails of about 175ms
+#define GRAIN_RELEASE       3
+#define GRAIN_CONTROL_RATE  64
+
+// Parameter smoothing. A voice doesn't jump to new values, whether it changes
+// its sound while it plays (live tweaks, edits, ties) or takes on a new step:
+// every GRAIN_SLEW_RATE samples each parameter closes 1/2^GRAIN_SLEW of the
+// distance left, a one pole slew of shifts and adds only. The default takes
+// about 2ms to cover two thirds of a change and 10ms to settle, so a step
+// still lands at once but without the click of the jump. A triggered voice
+// sets out from the values of the voice that was playing, the sound last
+// heard. GRAIN_SLEW 0 bypasses it.
+#ifndef GRAIN_SLEW
+#define GRAIN_SLEW          3
+#endif
+#define GRAIN_SLEW_RATE     8   // power of two, at most GRAIN_CONTROL_RATE
+
+// Everything that makes up the sound of a step
+struct VoiceParams {
+  uint16_t syncPhaseInc;
+  uint16_t grainPhaseInc;
+  uint16_t grain2PhaseInc;
+  uint8_t grainDecay;
+  uint8_t grain2Decay;
+  uint8_t grainWave;    // table of each grain, 0 to WAVES-1
+  uint8_t grain2Wave;
+};
+
+// Glide of the sync and grain 1 frequencies into new parameters: ticks
+// control ticks of the given increments, ending on the new values. The
+// caller works the increments out, so the engine never divides.
+struct VoiceSlide {
+  int16_t syncStep;
+  int16_t grainStep;
+  uint8_t ticks;        // 0 for no glide
+};
+
+struct GrainVoice {
+  uint16_t syncPhaseAcc;
+  uint16_t syncPhaseInc;
+  uint16_t grainPhaseAcc;
+  uint16_t grainPhaseInc;
+  uint16_t grainAmp;
+  uint8_t grainDecay;
+  uint16_t grain2PhaseAcc;
+  uint16_t grain2PhaseInc;
+  uint16_t grain2Amp;
+  uint8_t grain2Decay;
+  uint8_t grainWave;
+  uint8_t grain2Wave;
+  uint8_t level;        // amplitude the grains restart at, 255 = full
+  VoiceParams target;   // where the slew is taking the parameters above
+  bool settling;        // and they are not there yet
+  uint16_t syncEnd;     // where a glide ends
+  uint16_t grainEnd;
+  int16_t syncStep;
+  int16_t grainStep;
+  uint8_t slideTicks;   // control ticks of glide left
+};
+
+// Take over the parameters of another voice, for a slew to start from
+inline void grainFrom(GrainVoice &v, const GrainVoice &from) {
+  v.syncPhaseInc = from.syncPhaseInc;
+  v.grainPhaseInc = from.grainPhaseInc;
+  v.grain2PhaseInc = from.grain2PhaseInc;
+  v.grainDecay = from.grainDecay;
+  v.grain2Decay = from.grain2Decay;
+}
+
+// Put the parameters on their target
+inline void grainSnap(GrainVoice &v) {
+  v.syncPhaseInc = v.target.syncPhaseInc;
+  v.grainPhaseInc = v.target.grainPhaseInc;
+  v.grain2PhaseInc = v.target.grain2PhaseInc;
+  v.grainDecay = v.target.grainDecay;
+  v.grain2Decay = v.target.grain2Decay;
+  v.settling = false;
+}
+
+// The waves change at once, the rest through the slew
+inline void grainLoad(GrainVoice &v, const VoiceParams &p) {
+  v.target = p;
+  v.settling = true;
+  v.grainWave = p.grainWave;
+  v.grain2Wave = p.grain2Wave;
+}
+
+// Start the glide of v into the values just loaded, from where they would be
+// slide.ticks control ticks before the end
+inline void grainSlide(GrainVoice &v, const VoiceSlide &slide) {
+  v.slideTicks = slide.ticks;
+  if (!slide.ticks) return;
+  v.syncEnd = v.target.syncPhaseInc;
+  v.grainEnd = v.target.grainPhaseInc;
+  v.syncStep = slide.syncStep;
+  v.grainStep = slide.grainStep;
+  v.target.syncPhaseInc -= slide.syncStep * slide.ticks;
+  v.target.grainPhaseInc -= slide.grainStep * slide.ticks;
+}
+
+#if GRAIN_SLEW
+// One slew step of value towards target, rounded away from value so it
+// always gets there. moving is set while it hasn't.
+template <typename T>
+inline T grainSlew(T value, T target, bool &moving) {
+  if (value < target) {
+    moving = true;
+    return value + ((T)(target - value) >> GRAIN_SLEW) + 1;
+  }
+  if (value > target) {
+    moving = true;
+    return value - ((T)(value - target) >> GRAIN_SLEW) - 1;
+  }
+  return value;
+}
+
+inline void grainSettle(GrainVoice &v) {
+  bool moving = false;
+  v.syncPhaseInc = grainSlew(v.syncPhaseInc, v.target.syncPhaseInc, moving);
+  v.grainPhaseInc = grainSlew(v.grainPhaseInc, v.target.grainPhaseInc, moving);
+  v.grain2PhaseInc = grainSlew(v.grain2PhaseInc, v.target.grain2PhaseInc, moving);
+  v.grainDecay = grainSlew(v.grainDecay, v.target.grainDecay, moving);
+  v.grain2Decay = grainSlew(v.grain2Decay, v.target.grain2Decay, moving);
+  v.settling = moving;
+}
+#endif
+
+// Restart both grains at the voice level
+inline void grainRestart(GrainVoice &v) {
+  // 0..255 onto 0..0x7fff
+  uint16_t amp = ((uint16_t)v.level << 7) | (v.level >> 1);
+  v.grainPhaseAcc = 0;
+  v.grainAmp = amp;
+  v.grain2PhaseAcc = 0;
+  v.grain2Amp = amp;
+}
+
+// Advance the sync oscillator. Returns true when it wrapped, in which case both
+// grains have just been restarted; that is the moment to change parameters.
+inline bool grainSync(GrainVoice &v) {
+  v.syncPhaseAcc += v.syncPhaseInc;
+  if (v.syncPhaseAcc < v.syncPhaseInc) {
+    grainRestart(v);
+    return true;
+  }
+  return false;
+}
+
+// Render one sample of both grains, scaled to 0..253 (unclipped, see GrainEngine::mix())
+inline uint8_t grainRender(GrainVoice &v) {
+  uint8_t value;
+  uint16_t output;
+
+  // Increment the phase of the grain oscillators
+  v.grainPhaseAcc += v.grainPhaseInc;
+  v.grain2PhaseAcc += v.grain2PhaseInc;
+
+  // Look the phase up in the grain's wavetable: the table number and the top
+  // byte of the phase make up the offset, a single flash read and no branch
+  value = pgm_read_byte(&waveTables.wave[v.grainWave][v.grainPhaseAcc >> 8]);
+  // Multiply by current grain amplitude to get sample
+  output = mulU8(value, v.grainAmp >> 8);
+
+  // Repeat for second grain
+  value = pgm_read_byte(&waveTables.wave[v.grain2Wave][v.grain2PhaseAcc >> 8]);
+  output += mulU8(value, v.grain2Amp >> 8);
+
+  // Make the grain amplitudes decay by a factor every sample (exponential decay).
+  // The amplitude tops out at 0x7fff, so the product is always smaller than it;
+  // the saturation only guards that.
+  v.grainAmp = satSubU16(v.grainAmp, mulU8(v.grainAmp >> 8, v.grainDecay));
+  v.grain2Amp = satSubU16(v.grain2Amp, mulU8(v.grain2Amp >> 8, v.grain2Decay));
+
+  // Each grain peaks at 255 * 127, so the pair always fits in 8 bits after this
+  return output >> 8;
+}
+
+template <uint8_t VOICES>
+struct GrainEngine {
+  GrainVoice voice[VOICES];
+  uint8_t active;       // voice playing the current step
+  uint8_t tick;
+
+  // Start a step on voice i, the voice that was playing fades out. Voice i
+  // slews over to the step from where that one was.
+  inline void trigger(uint8_t i, const VoiceParams &p, const VoiceSlide &slide = VoiceSlide()) {
+#if GRAIN_SLEW
+    if (i != active) grainFrom(voice[i], voice[active]);
+#endif
+    grainLoad(voice[i], p);
+    grainSlide(voice[i], slide);
+#if !GRAIN_SLEW
+    grainSnap(voice[i]);
+#endif
+    voice[i].level = 255;
+    active = i;
+  }
+
+  // Change the sound of voice i without restarting it
+  inline void update(uint8_t i, const VoiceParams &p, const VoiceSlide &slide = VoiceSlide()) {
+    grainLoad(voice[i], p);
+    grainSlide(voice[i], slide);
+#if !GRAIN_SLEW
+    grainSnap(voice[i]);
+#endif
+  }
+
+  // Hit voice i again right away, a ratchet
+  inline void retrigger(uint8_t i) {
+    voice[i].level = 255;
+    voice[i].syncPhaseAcc = 0;
+    grainRestart(voice[i]);
+  }
+
+  // End the note on voice i: the grains playing ring out, the next ones are silent
+  inline void release(uint8_t i) {
+    voice[i].level = 0;
+  }
+
+  // Voice i has faded out all the way: its level is down to 0 and the grains
+  // still ringing have decayed below the last bit of the output. A new step
+  // can take it over at once, with nothing left to cut off, rather than wait
+  // for its next grain boundary. A voice still fading waits for the boundary.
+  inline bool silent(uint8_t i) const {
+    const GrainVoice &v = voice[i];
+    return !v.level && !(v.grainAmp >> 8) && !(v.grain2Amp >> 8);
+  }
+
+  // Voice the next step should go to
+  inline uint8_t next() const {
+    return (active + 1 == VOICES) ? 0 : active + 1;
+  }
+
+  // Render and mix one sample of all voices. A single voice only swings up to
+  // 126 after the final shift, the same range the original sketch used, which
+  // leaves the top half of the 8 bit output as headroom for overlapping tails;
+  // only three or more voices at full level can clip.
+  inline uint8_t mix() {
+    uint16_t output = 0;
+    for (uint8_t i = 0; i < VOICES; i++) {
+      output += grainRender(voice[i]);
+    }
+    output >>= 1;
+    if (output > 255) output = 255;
+
+    ++tick;
+#if GRAIN_SLEW
+    // Voices that have settled cost a test each
+    if ((tick & (GRAIN_SLEW_RATE - 1)) == 0) {
+      for (uint8_t i = 0; i < VOICES; i++) {
+        if (voice[i].settling) grainSettle(voice[i]);
+      }
+    }
+#endif
+
+    // Glides, and fading out every voice but the active one, at the control rate
+    if (tick == GRAIN_CONTROL_RATE) {
+      tick = 0;
+      for (uint8_t i = 0; i < VOICES; i++) {
+        GrainVoice &v = voice[i];
+        if (v.slideTicks) {
+          if (--v.slideTicks) {
+            v.target.syncPhaseInc += v.syncStep;
+            v.target.grainPhaseInc += v.grainStep;
+          }
+          else {
+            v.target.syncPhaseInc = v.syncEnd;
+            v.target.grainPhaseInc = v.grainEnd;
+          }
+#if GRAIN_SLEW
+          v.settling = true;
+#else
+          grainSnap(v);
+#endif
+        }
+        if (i == active) continue;
+        uint8_t level = v.level;
+        v.level = (level > GRAIN_RELEASE) ? level - GRAIN_RELEASE : 0;
+      }
+    }
+    return output;
+  }
+};
+
+#endif
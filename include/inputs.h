@@ -0,0 +1,41 @@
+#ifndef INPUTS_H
+#define INPUTS_H
+
+#include <Arduino.h>
+
+// Button and switch scanner. Every input sits on PORTA or PORTC, so a 1kHz
+// timer interrupt grabs all of them with two port reads, debounces the lot
+// in parallel with a two bit vertical counter (a change has to hold for four
+// ticks) and queues a press or release event for each input that settled.
+// loop() drains the events with inputEvent() and can look at the debounced
+// levels with inputDown(); neither ever touches digitalRead().
+//
+// Inputs are numbered by their bit in PINA | PINC << 8. All of them are
+// active low, "down" means the button is held or the switch is at LOW.
+#define IN_PIN22   0
+#define IN_PIN24   2
+#define IN_PIN26   4
+#define IN_PIN27   5
+#define IN_PIN28   6
+#define IN_PIN29   7
+#define IN_PIN37   8
+#define IN_PIN36   9
+#define IN_PIN35  10
+#define IN_PIN34  11
+#define IN_PIN33  12
+#define IN_PIN32  13
+#define IN_PIN31  14
+#define IN_PIN30  15
+
+#define INPUT_BIT(in) ((uint16_t)1 << (in))
+
+// Event queue entries: the input number, with the top bit set for a release
+#define INPUT_RELEASED 0x80
+#define INPUT_NONE     0xFF
+#define INPUT_QUEUE    16   // power of two
+
+void inputBegin();
+uint8_t inputEvent();
+bool inputDown(uint8_t in);
+
+#endif
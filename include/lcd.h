@@ -0,0 +1,51 @@
+#ifndef LCD_H
+#define LCD_H
+
+#include <Arduino.h>
+
+// Non-blocking driver for the 16x2 HD44780 LCD. Printing only writes into a
+// shadow of the screen in RAM and never waits on the display. A 1kHz timer
+// interrupt (Timer 5 compare B, on the timer inputBegin() starts) compares
+// the shadow with what the display shows and sends it one command or one
+// character per tick, for the cells that changed only. The display takes
+// 37us per byte, far less than a tick, so nothing ever polls or delays;
+// clear() is 32 spaces in the shadow rather than the 1.5ms clear command.
+// A full screen takes at most about 40ms to go out.
+//
+// The display runs 4 bit and write only (R/W tied low). The pins are the
+// panel's, set LCD_RS ... LCD_D7 to wire it elsewhere, e.g. off pins 1 and 2
+// so Serial keeps its TX pin.
+#ifndef LCD_RS
+#define LCD_RS  1
+#endif
+#ifndef LCD_EN
+#define LCD_EN  2
+#endif
+#ifndef LCD_D4
+#define LCD_D4  4
+#endif
+#ifndef LCD_D5
+#define LCD_D5  5
+#endif
+#ifndef LCD_D6
+#define LCD_D6  6
+#endif
+#ifndef LCD_D7
+#define LCD_D7  7
+#endif
+
+#define LCD_COLS  16
+#define LCD_ROWS  2
+
+// Print on the shadow. Text runs on from the cursor and anything past the
+// end of the row is dropped.
+class LcdScreen : public Print {
+public:
+  void begin();
+  void clear();
+  void setCursor(uint8_t col, uint8_t row);
+  virtual size_t write(uint8_t c);
+  using Print::write;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef LEDS_H
+#define LEDS_H
+
+#include <Arduino.h>
+
+// Step LED framebuffer, bit n lights the LED of step n+1. ledShow() maps it
+// straight onto the port registers instead of going through 16 digitalWrite()
+// calls, so a whole frame lands at once in a handful of cycles.
+//
+// Pins 38-53 sit on four ports, from bit 0 up:
+//   PORTB  pins 53 52 51 50               steps 1  9  2 10
+//   PORTL  pins 49 48 47 46 45 44 43 42   steps 3 11  4 12  5 13  6 14
+//   PORTG  pins 41 40 39                  steps 7 15  8
+//   PORTD  pin  38 (bit 7)                step 16
+// The steps alternate between the top and the bottom row, which is just the
+// bits of the two frame bytes interleaved.
+
+#define STEP_BIT(step) ((uint16_t)1 << ((step) - 1))
+
+extern uint16_t ledFrame;
+
+void ledBegin();
+void ledShow(uint16_t frame);
+
+#endif
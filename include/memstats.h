@@ -0,0 +1,19 @@
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <Arduino.h>
+
+// RAM budget figures. Before the C runtime starts, all RAM between the end
+// of the static data and the top of the stack is painted with STACK_CANARY
+// (there is no heap, nothing calls malloc). The stack grows down into it, so
+// the canary bytes still intact just above the static data are RAM that has
+// never been used since power up.
+//
+// The same numbers for a build come from the memreport target, which runs
+// the firmware under simavr (tools/memreport).
+#define STACK_CANARY 0xC5
+
+uint16_t staticRam();
+uint16_t stackUnused();
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef MIDI_H
+#define MIDI_H
+
+#include <Arduino.h>
+
+// MIDI in and out on USART1 (RX1 pin 19, TX1 pin 18). USART0 is no use
+// here: the LCD sits on pins 1 and 2.
+//
+// The receive interrupt passes real time messages (clock, start, stop...)
+// straight to the sequencer clock and queues every other byte. loop() parses
+// the queue with midiRead(), which hands back channel messages and complete
+// SysEx messages one at a time, so nothing that arrives ever holds up the
+// audio interrupt for more than a byte. Sending goes through a ring emptied
+// by the transmit interrupt; a SysEx dump too big for it is streamed by
+// midiTask() as room comes free.
+//
+// SysEx payloads are 8 bit data packed into 7 bit bytes: every group of up
+// to 7 bytes goes out as one byte holding their top bits (first byte in bit
+// 0) followed by the 7 low bits of each.
+#define MIDI_BAUD        31250
+#define MIDI_RX_QUEUE    64     // power of two
+#define MIDI_TX_QUEUE    32     // power of two
+#define MIDI_SYSEX_MAX   244    // longest SysEx payload taken in, longer ones are dropped
+
+#define MIDI_SYSEX       0xF0
+#define MIDI_SYSEX_END   0xF7
+
+struct MidiMessage {
+  uint8_t status;       // MIDI_SYSEX for a SysEx, see midiSysex()
+  uint8_t data1;
+  uint8_t data2;
+};
+
+void midiBegin();
+bool midiRead(MidiMessage &m);
+const uint8_t *midiSysex(uint8_t *length);
+bool midiSend(uint8_t status, uint8_t data1, uint8_t data2);
+bool midiSendSysex(const uint8_t *header, uint8_t headerLength, const uint8_t *data, uint8_t length);
+bool midiSending();
+void midiTask();
+uint8_t midiUnpack(const uint8_t *in, uint8_t length, uint8_t *out, uint8_t max);
+
+#endif
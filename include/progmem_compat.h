@@ -0,0 +1,17 @@
+#ifndef PROGMEM_COMPAT_H
+#define PROGMEM_COMPAT_H
+
+#include <stdint.h>
+
+// Flash tables for the headers the offline renderer shares with the board.
+// On the AVR they go to flash and are read back with pgm_read_byte; on a PC
+// there is a single address space and PROGMEM means nothing.
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#endif
+#ifndef PROGMEM
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#endif
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef QUANTIZER_H
+#define QUANTIZER_H
+
+#include <Arduino.h>
+
+// Pitch quantizer for the sync pot. The pot covers the 128 MIDI notes, a
+// note every 8 ADC steps with the top end of the pot as a rest (no sync),
+// and every position snaps to the nearest note of the selected scale and
+// root, the lower one on a tie. All SCALES x 12 roots of it are worked out
+// by the compiler (constexpr, needs -std=gnu++14) into one table in flash,
+// so quantize() is a single flash read with no arithmetic beyond a shift.
+//
+// Scales are 12 bit masks, bit n set for the note n semitones above the
+// root. SCALE_USER_MASK sets the user scale at build time.
+#define SCALE_CHROMATIC   0
+#define SCALE_MAJOR       1
+#define SCALE_MINOR       2
+#define SCALE_PENTATONIC  3
+#define SCALE_USER        4
+#define SCALES            5
+
+#ifndef SCALE_USER_MASK
+#define SCALE_USER_MASK   0x4A9   // minor pentatonic
+#endif
+
+// The scale the original sketch was fixed to, G major pentatonic
+#define SCALE_DEFAULT     SCALE_PENTATONIC
+#define SCALE_ROOT        7
+
+void setScale(uint8_t scale, uint8_t root);
+uint16_t quantize(uint16_t input);
+const __FlashStringHelper *scaleName(uint8_t scale);
+void printRoot(Print &out, uint8_t root);
+
+#endif
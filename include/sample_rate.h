@@ -0,0 +1,13 @@
+#ifndef SAMPLE_RATE_H
+#define SAMPLE_RATE_H
+
+// The audio sample clock: timer 3 runs phase correct PWM with no prescaler,
+// counting up and down 255 steps, so a sample every 510 CPU cycles, 31372.5Hz
+// at 16MHz. Shared with the host builds, which have no F_CPU of their own.
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+#define SAMPLE_DIVIDER 510
+#define SAMPLE_RATE_HZ ((double)F_CPU / SAMPLE_DIVIDER)
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include <avr/io.h>
+
+// Run time telemetry, only built with -D TELEMETRY (the telemetry
+// environment); without it every call below is empty and costs nothing.
+//
+// Timer 4 runs free at the CPU clock, so its count is a cycle stamp: the
+// audio interrupts stamp their start and end, loop() the start of every
+// pass, and the clock the moment it raises a step. All of it lands in the
+// telemetry struct, which a debugger or simavr can read by its symbol, and
+// telemetryShow() puts on the LCD. The figures:
+//  - audioLoad: share of the CPU the audio interrupts took over the last
+//    second, in percent. Interrupt entry and exit (about 40 cycles each) are
+//    not in it.
+//  - sampleMax, sampleHist: cycles spent rendering one sample (a block's
+//    worth averaged over the block), the worst since power up and a count in
+//    64 cycle bins, the last bin for 448 and over. A sample lasts 510.
+//  - loopMin, loopMax, loopAvg: the loop() period in microseconds, min and
+//    max since the last reset, the average over the last second
+//  - stepLateMax: the longest a step waited between the clock raising it and
+//    loop() playing it, in microseconds. stepsLate counts the ones that
+//    waited more than TELEMETRY_LATE_US, stepsMissed the ones loop() only got
+//    to after the next was due as well.
+//  - stackFree: RAM never touched by the stack (memstats.h), once a second
+//
+// telemetryReset() starts the min/max figures and counters over.
+#define TELEMETRY_BINS      8
+#define TELEMETRY_BIN_SHIFT 6
+#define TELEMETRY_LATE_US   1000
+
+struct Telemetry {
+  uint32_t audioBusy;       // cycles in the audio interrupts, this second so far
+  uint16_t sampleMax;
+  uint16_t sampleHist[TELEMETRY_BINS];
+  uint16_t loopMin;
+  uint16_t loopMax;
+  uint32_t loopTotal;       // loop() passes and their time, this second so far
+  uint16_t loopCount;
+  uint16_t stepLateMax;
+  uint16_t stepsLate;
+  uint16_t stepsMissed;
+  uint32_t stepRaised;      // cycle stamp of the last step the clock raised
+  // Once a second
+  uint8_t audioLoad;
+  uint16_t loopAvg;
+  uint16_t stackFree;
+};
+
+#ifdef TELEMETRY
+
+extern Telemetry telemetry;
+
+void telemetryBegin();
+void telemetryReset();
+uint32_t telemetryClock();
+void telemetryLoop();
+void telemetryStepTaken(uint8_t backlog);
+void telemetryShow(Print &out, uint8_t line);
+
+inline uint16_t telemetryStamp() {
+  return TCNT4;
+}
+
+// End of an audio interrupt that started at stamp and rendered samples of
+// them (0 for the overflow only playing one back). Called with interrupts
+// enabled from the render interrupt, so the overflow may cut in.
+inline void telemetryAudio(uint16_t stamp, uint8_t samples) {
+  uint16_t cycles = TCNT4 - stamp;
+  uint8_t sreg = SREG;
+  cli();
+  telemetry.audioBusy += cycles;
+  SREG = sreg;
+  if (!samples) return;
+  uint16_t sample = cycles / samples;
+  if (sample > telemetry.sampleMax) telemetry.sampleMax = sample;
+  uint8_t bin = sample >> TELEMETRY_BIN_SHIFT;
+  if (bin >= TELEMETRY_BINS) bin = TELEMETRY_BINS - 1;
+  if (telemetry.sampleHist[bin] != 0xFFFF) telemetry.sampleHist[bin]++;
+}
+
+// The clock just raised a step, from the audio interrupt
+inline void telemetryStep() {
+  telemetry.stepRaised = telemetryClock();
+}
+
+#else
+
+inline void telemetryBegin() {}
+inline void telemetryReset() {}
+inline void telemetryLoop() {}
+inline void telemetryStepTaken(uint8_t) {}
+inline void telemetryShow(Print &, uint8_t) {}
+inline uint16_t telemetryStamp() { return 0; }
+inline void telemetryAudio(uint16_t, uint8_t) {}
+inline void telemetryStep() {}
+
+#endif
+
+#endif
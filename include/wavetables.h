@@ -0,0 +1,35 @@
+#ifndef WAVETABLES_H
+#define WAVETABLES_H
+
+#include <stdint.h>
+
+#include "progmem_compat.h"
+
+// Grain waveforms, one 256 byte table each in flash, indexed by the top byte
+// of the grain phase. All of them span 0..255 like the triangle the grains
+// always played, so any of them fits the same mix headroom. The tables are
+// worked out by the compiler (constexpr, see wavetables.cpp), the user one
+// as a sum of sine harmonics with the amplitudes in WAVE_USER_HARMONICS.
+#define WAVE_TRIANGLE   0
+#define WAVE_SINE       1
+#define WAVE_SAW        2
+#define WAVE_SQUARE     3
+#define WAVE_PULSE      4     // 25% duty
+#define WAVE_FORMANT    5     // bursts of the 4th harmonic
+#define WAVE_FORMANT2   6     // and of the 7th
+#define WAVE_USER       7
+#define WAVES           8
+
+#ifndef WAVE_USER_HARMONICS
+#define WAVE_USER_HARMONICS 12, 0, 6, 0, 4, 0, 3   // odd harmonics, a soft square
+#endif
+
+struct WaveTables {
+  uint8_t wave[WAVES][256];
+
+  constexpr WaveTables();
+};
+
+extern const WaveTables waveTables PROGMEM;
+
+#endif
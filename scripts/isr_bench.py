@@ -0,0 +1,25 @@
+# Adds the "isrbench" target: builds tools/isrbench against simavr and runs
+# the firmware of this environment through it.
+#
+#   pio run -e isrbench -t isrbench
+#
+# The cycle budget comes from custom_isr_budget in platformio.ini.
+
+Import("env")
+
+budget = env.GetProjectOption("custom_isr_budget", "400")
+seconds = env.GetProjectOption("custom_isr_seconds", "2")
+
+bench = env.Command(
+    "$BUILD_DIR/isrbench",
+    "$PROJECT_DIR/tools/isrbench/isrbench.c",
+    "cc -O2 -o $TARGET $SOURCE -lsimavr -lelf",
+)
+
+env.AddCustomTarget(
+    name="isrbench",
+    dependencies=["$BUILD_DIR/${PROGNAME}.elf", bench],
+    actions=["$BUILD_DIR/isrbench $BUILD_DIR/${PROGNAME}.elf %s %s" % (budget, seconds)],
+    title="ISR benchmark",
+    description="Cycle counts of the PWM interrupt under simavr",
+)
@@ -0,0 +1,67 @@
+# Adds the "memreport" target: RAM taken by every section and the largest
+# RAM symbols of this environment's firmware, then its peak stack use under
+# simavr (tools/memreport).
+#
+#   pio run -e megaatmega2560 -t memreport
+
+import subprocess
+
+Import("env")
+
+seconds = env.GetProjectOption("custom_memreport_seconds", "2")
+
+RAM_SECTIONS = (".data", ".bss", ".noinit")
+RAM_TYPES = "bBdD"
+
+
+def tool(name):
+    return env.subst("$CC").replace("gcc", name)
+
+
+def report(target, source, env):
+    elf = env.subst("$BUILD_DIR/${PROGNAME}.elf")
+
+    sizes = subprocess.check_output([tool("size"), "-A", elf], text=True)
+    total = 0
+    print("RAM by section")
+    for line in sizes.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] in RAM_SECTIONS:
+            total += int(fields[1])
+            print("  %-8s %6s" % (fields[0], fields[1]))
+    print("  %-8s %6d of 8192" % ("total", total))
+
+    symbols = subprocess.check_output([tool("nm"), "-S", "-C", "--size-sort", "-t", "d", elf], text=True)
+    ram = []
+    end = None
+    for line in symbols.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) == 4 and fields[2] in RAM_TYPES:
+            ram.append((int(fields[1]), fields[3]))
+    print("Largest RAM symbols")
+    for size, name in sorted(ram, reverse=True)[:15]:
+        print("  %6d %s" % (size, name))
+
+    for line in subprocess.check_output([tool("nm"), elf], text=True).splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[2] == "_end":
+            end = int(fields[0], 16)
+    if end is None:
+        print("no _end symbol, skipping the stack measurement")
+        return 0
+    return subprocess.call([env.subst("$BUILD_DIR/memreport"), elf, str(end), seconds])
+
+
+bench = env.Command(
+    "$BUILD_DIR/memreport",
+    "$PROJECT_DIR/tools/memreport/memreport.c",
+    "cc -O2 -o $TARGET $SOURCE -lsimavr -lelf",
+)
+
+env.AddCustomTarget(
+    name="memreport",
+    dependencies=["$BUILD_DIR/${PROGNAME}.elf", bench],
+    actions=[report],
+    title="Memory report",
+    description="Static RAM per section and peak stack under simavr",
+)
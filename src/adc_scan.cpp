@@ -0,0 +1,75 @@
+#include "adc_scan.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+// Every analog input the sequencer uses: the five synth pots (0-4), the live
+// tweak pots (8-11, 14), with -D LIVE_CUTOFF the extra cutoff pot (12), and
+// the tempo / step count pot (15). A12 floats on a panel without that pot.
+static const uint8_t adcChannels[] PROGMEM = {0, 1, 2, 3, 4, 8, 9, 10, 11,
+#ifdef LIVE_CUTOFF
+  12,
+#endif
+  14, 15};
+#define ADC_CHANNELS sizeof(adcChannels)
+#define ADC_NO_SLOT  0xFF
+
+static uint8_t adcSlot[16];
+static volatile uint16_t adcValue[ADC_CHANNELS];
+
+static uint8_t adcCurrent = 0;
+static int8_t adcCount = -1;     // -1 marks the settling conversion
+static uint16_t adcAccum = 0;
+
+static void adcSelect(uint8_t channel){
+  ADMUX = _BV(REFS0) | (channel & 0x07);
+  if(channel & 0x08){ADCSRB |= _BV(MUX5);}
+  else{ADCSRB &= ~_BV(MUX5);}
+}
+
+ISR(ADC_vect){
+  uint16_t sample = ADC;
+
+  if(adcCount >= 0){
+    adcAccum += sample;
+  }
+  if(++adcCount == ADC_OVERSAMPLE){
+    uint16_t value = adcAccum >> ADC_OVERSAMPLE_SHIFT;
+    uint16_t cached = adcValue[adcCurrent];
+    // The end stops always get through, otherwise the hysteresis could keep
+    // a pot from ever reading 0 or 1023
+    if(value > cached + ADC_HYSTERESIS || value + ADC_HYSTERESIS < cached ||
+       value == 0 || value == 1023){
+      adcValue[adcCurrent] = value;
+    }
+    adcAccum = 0;
+    adcCount = -1;
+    if(++adcCurrent == ADC_CHANNELS){adcCurrent = 0;}
+    adcSelect(pgm_read_byte(&adcChannels[adcCurrent]));
+  }
+  ADCSRA |= _BV(ADSC);
+}
+
+void adcBegin(){
+  for(uint8_t i = 0; i < 16; i++){adcSlot[i] = ADC_NO_SLOT;}
+  for(uint8_t i = 0; i < ADC_CHANNELS; i++){adcSlot[pgm_read_byte(&adcChannels[i])] = i;}
+
+  adcSelect(pgm_read_byte(&adcChannels[0]));
+  // 16MHz / 128 = 125kHz ADC clock, one conversion every 104us
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  ADCSRA |= _BV(ADSC);
+}
+
+// Latest filtered value of an analog input, 0-1023. The cache is written from
+// the interrupt, so read it twice and retry on a torn 16 bit value.
+uint16_t adcRead(uint8_t channel){
+  uint8_t slot = adcSlot[channel & 0x0F];
+  if(slot == ADC_NO_SLOT){return 0;}
+  uint16_t a, b;
+  do{
+    a = adcValue[slot];
+    b = adcValue[slot];
+  }while(a != b);
+  return a;
+}
@@ -0,0 +1,234 @@
+#include "bank.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#define BANK_SLOT     18
+#define BANK_SLOTS    ((E2END + 1) / BANK_SLOT - 1)   // one short, so 0xFF can mean "never saved"
+#define BANK_NONE     0xFF
+#define BANK_VERSION  4     // seeds the CRC, bump it when the record layout changes
+
+// Pattern settings when nothing has been saved yet, as the sketch starts up
+#define BANK_TEMPO    120
+#define BANK_LENGTH   8
+
+// The 24 bit sequence number lasts 16 million records, a year of saving every
+// two seconds around the clock and most of the EEPROM's rated wear
+struct Record {
+  uint32_t seq : 24;
+  uint32_t key : 8;     // pattern << 5 | index, the index being a step or BANK_SETTINGS,
+                        // or BANK_SONG with the part of the song in place of the pattern
+  uint8_t data[BANK_SLOT - 5];
+  uint8_t crc;
+};
+
+#define BANK_SONG         (BANK_SETTINGS + 1)
+#define BANK_INDEXES      (BANK_SONG + 1)
+
+#define RECORD_ERASED     0xFFFFFFUL
+#define RECORD_KEY_OFFSET 3
+
+#define RECORD_KEY(pattern, index) ((pattern) << 5 | (index))
+#define KEY_PATTERN(key)  ((key) >> 5)
+#define KEY_INDEX(key)    ((key) & 0x1F)
+
+static_assert(sizeof(Record) == BANK_SLOT, "a record fills one slot");
+static_assert(sizeof(Step) <= sizeof(Record().data), "a step must fit in one record");
+static_assert(SONG_PART_ENTRIES * sizeof(SongEntry) + 1 <= sizeof(Record().data), "a part of the song and the entry count must fit in one record");
+static_assert(SONG_PARTS <= BANK_PATTERNS, "a part of the song is keyed like a pattern");
+static_assert(BANK_PATTERNS * BANK_INDEXES < BANK_SLOTS, "the bank needs free slots to rotate through");
+static_assert(BANK_PATTERNS <= 8 && BANK_SONG < 32, "pattern and index share the key byte");
+
+// Slot of the newest record of every step, settings and part of the song,
+// BANK_NONE if there is none
+static uint8_t latest[BANK_PATTERNS][BANK_INDEXES];
+static uint32_t nextSeq = 0;
+static uint8_t head = 0;            // where the search for a free slot starts
+
+// Records waiting to be written. queue[0] is the one going out, written
+// counts its bytes that have been.
+static Record queue[BANK_QUEUE];
+static uint8_t queued = 0;
+static uint8_t written = 0;
+static uint8_t target;
+
+static Pattern *loadInto = NULL;
+static uint8_t loadPattern;
+static uint8_t loadIndex;
+
+static uint8_t *slotAddress(uint8_t slot){
+  return (uint8_t *)((uint16_t)slot * BANK_SLOT);
+}
+
+static uint8_t nextSlot(uint8_t slot){
+  return (slot + 1 == BANK_SLOTS) ? 0 : slot + 1;
+}
+
+static uint8_t recordCrc(const Record &r){
+  const uint8_t *b = (const uint8_t *)&r;
+  uint8_t crc = BANK_VERSION;
+  for(uint8_t i = 0; i < offsetof(Record, crc); i++){crc = _crc8_ccitt_update(crc, b[i]);}
+  return crc;
+}
+
+static bool recordValid(const Record &r){
+  return r.seq != RECORD_ERASED && KEY_PATTERN(r.key) < BANK_PATTERNS && KEY_INDEX(r.key) < BANK_INDEXES &&
+         r.crc == recordCrc(r);
+}
+
+static uint32_t slotSeq(uint8_t slot){
+  return eeprom_read_dword((uint32_t *)slotAddress(slot)) & RECORD_ERASED;
+}
+
+// A slot is in use while it holds the newest copy of something
+static bool slotLive(uint8_t slot){
+  uint8_t key = eeprom_read_byte(slotAddress(slot) + RECORD_KEY_OFFSET);
+  return KEY_PATTERN(key) < BANK_PATTERNS && KEY_INDEX(key) < BANK_INDEXES &&
+         latest[KEY_PATTERN(key)][KEY_INDEX(key)] == slot;
+}
+
+// Scan the whole ring, about 20ms, so only from setup()
+void bankBegin(){
+  memset(latest, BANK_NONE, sizeof(latest));
+  bool any = false;
+  uint32_t newest = 0;
+  for(uint8_t s = 0; s < BANK_SLOTS; s++){
+    Record r;
+    eeprom_read_block(&r, slotAddress(s), BANK_SLOT);
+    if(!recordValid(r)){continue;}
+    uint8_t &l = latest[KEY_PATTERN(r.key)][KEY_INDEX(r.key)];
+    if(l == BANK_NONE || r.seq > slotSeq(l)){l = s;}
+    if(!any || r.seq > newest){
+      any = true;
+      newest = r.seq;
+      head = nextSlot(s);
+    }
+  }
+  nextSeq = any ? newest + 1 : 0;
+}
+
+// The queued record for key to be filled in, cleared. A record still waiting
+// for the same thing is reused. NULL when the queue is full.
+static Record *queueRecord(uint8_t key){
+  Record *r = NULL;
+  for(uint8_t i = written ? 1 : 0; i < queued; i++){
+    if(queue[i].key == key){r = &queue[i];}
+  }
+  if(!r){
+    if(queued == BANK_QUEUE){return NULL;}
+    r = &queue[queued++];
+  }
+  r->key = key;
+  memset(r->data, 0, sizeof(r->data));
+  return r;
+}
+
+// The newest copy of key, from the queue or read from the EEPROM into r,
+// NULL if it was never saved
+static const Record *findRecord(uint8_t key, Record &r){
+  const Record *found = NULL;
+  for(uint8_t i = 0; i < queued; i++){
+    if(queue[i].key == key){found = &queue[i];}
+  }
+  uint8_t slot = latest[KEY_PATTERN(key)][KEY_INDEX(key)];
+  if(!found && slot != BANK_NONE){
+    eeprom_read_block(&r, slotAddress(slot), BANK_SLOT);
+    found = &r;
+  }
+  return found;
+}
+
+// Queue a step (index < NUMSTEPS) or the settings of pattern p for writing.
+// Returns false when the queue is full, try again later.
+bool bankSave(uint8_t pattern, uint8_t index, const Pattern &p){
+  Record *r = queueRecord(RECORD_KEY(pattern, index));
+  if(!r){return false;}
+  if(index < NUMSTEPS){memcpy(r->data, &p.steps[index], sizeof(Step));}
+  else{
+    r->data[0] = p.tempo;
+    r->data[1] = p.length;
+  }
+  return true;
+}
+
+// Queue a part of the song, the first one carries the entry count as well
+bool bankSaveSong(uint8_t part, const Song &song){
+  Record *r = queueRecord(RECORD_KEY(part, BANK_SONG));
+  if(!r){return false;}
+  memcpy(r->data, &song.entry[part * SONG_PART_ENTRIES], SONG_PART_ENTRIES * sizeof(SongEntry));
+  if(part == 0){r->data[sizeof(r->data) - 1] = song.count;}
+  return true;
+}
+
+// Read the song at once, setup() only; parts never saved come back as zero
+void bankLoadSong(Song &song){
+  for(uint8_t part = 0; part < SONG_PARTS; part++){
+    Record r;
+    const Record *found = findRecord(RECORD_KEY(part, BANK_SONG), r);
+    SongEntry *e = &song.entry[part * SONG_PART_ENTRIES];
+    if(found){memcpy(e, found->data, SONG_PART_ENTRIES * sizeof(SongEntry));}
+    else{memset(e, 0, SONG_PART_ENTRIES * sizeof(SongEntry));}
+    if(part == 0){song.count = found ? min(found->data[sizeof(r.data) - 1], SONG_ENTRIES) : 0;}
+  }
+}
+
+// Fill p with pattern n over the next passes of bankTask()
+void bankLoad(uint8_t pattern, Pattern *p){
+  loadPattern = pattern;
+  loadIndex = 0;
+  loadInto = p;
+}
+
+bool bankLoading(){
+  return loadInto != NULL;
+}
+
+// One step or the settings of the pattern being loaded. Records still in the
+// queue are newer than anything in the EEPROM.
+static void loadNext(){
+  Record r;
+  const Record *found = findRecord(RECORD_KEY(loadPattern, loadIndex), r);
+
+  if(loadIndex < NUMSTEPS){
+    Step &s = loadInto->steps[loadIndex];
+    if(found){memcpy(&s, found->data, sizeof(Step));}
+    else{memset(&s, 0, sizeof(Step));}
+  }
+  else{
+    loadInto->tempo = found ? found->data[0] : BANK_TEMPO;
+    loadInto->length = found ? constrain(found->data[1], 1, NUMSTEPS) : BANK_LENGTH;
+  }
+  if(++loadIndex > BANK_SETTINGS){loadInto = NULL;}
+}
+
+void bankTask(){
+  // Reads have to wait for a write in progress as well
+  if(!eeprom_is_ready()){return;}
+
+  if(loadInto){
+    loadNext();
+    return;
+  }
+  if(!queued){return;}
+
+  Record &r = queue[0];
+  if(written == 0){
+    // Most slots are free, so this always ends, usually on the first one
+    while(slotLive(head)){head = nextSlot(head);}
+    target = head;
+    head = nextSlot(head);
+    r.seq = nextSeq++;
+    r.crc = recordCrc(r);
+  }
+
+  // One byte per call, the EEPROM is busy for 3.4ms after each
+  eeprom_update_byte(slotAddress(target) + written, ((const uint8_t *)&r)[written]);
+  if(++written < BANK_SLOT){return;}
+
+  latest[KEY_PATTERN(r.key)][KEY_INDEX(r.key)] = target;
+  written = 0;
+  queued--;
+  memmove(&queue[0], &queue[1], queued * sizeof(Record));
+}
@@ -0,0 +1,53 @@
+#include "bus_filter.h"
+#include "sample_rate.h"
+
+// Host and board alike, the native renderer links this file as well
+
+#define FILTER_PI     3.14159265358979323846
+#define FILTER_FS     SAMPLE_RATE_HZ
+#define FILTER_TOP_HZ 5000.0
+#define FILTER_OCTAVES 6.0
+
+// 2^x, from the integer part and the series of e^(x ln 2) for the rest
+static constexpr double filterExp2(double x){
+  double whole = 1;
+  while(x >= 1){whole *= 2; x -= 1;}
+  while(x < 0){whole /= 2; x += 1;}
+  double term = 1, sum = 1;
+  for(int n = 1; n < 16; n++){
+    term *= x * 0.69314718055994531 / n;
+    sum += term;
+  }
+  return whole * sum;
+}
+
+static constexpr double filterSin(double x){
+  double term = x, sum = x;
+  for(int n = 1; n < 12; n++){
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+static constexpr uint8_t filterQ8(double v){
+  return (v >= 255.0 / 256) ? 255 : (uint8_t)(v * 256 + 0.5);
+}
+
+constexpr FilterTables::FilterTables() : f(), q() {
+  for(int i = 0; i < FILTER_CUTOFFS; i++){
+    double hz = FILTER_TOP_HZ * filterExp2(FILTER_OCTAVES * (i - (FILTER_CUTOFFS - 1)) / (FILTER_CUTOFFS - 1));
+    f[i] = filterQ8(2 * filterSin(FILTER_PI * hz / FILTER_FS));
+  }
+  // Q doubles every 15/4 steps
+  for(int r = 0; r < FILTER_RESONANCES; r++){
+    q[r] = filterQ8(1 / filterExp2(4.0 * r / (FILTER_RESONANCES - 1)));
+  }
+}
+
+constexpr FilterTables filterTables PROGMEM = FilterTables();
+
+// Q of 1 and of 16, and f at the 5kHz top, 2 sin(pi 5000 / 31372.5) in Q8
+static_assert(filterTables.q[0] == 255, "Q 1");
+static_assert(filterTables.q[FILTER_RESONANCES - 1] == 16, "Q 16");
+static_assert(filterTables.f[FILTER_CUTOFFS - 1] == 246, "f at 5kHz");
@@ -0,0 +1,143 @@
+#include "clock.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+volatile uint8_t stepsRaised = 0;
+volatile bool clockRestart = false;
+
+bool extSync = false;
+uint16_t stepCountdown = 1;
+uint16_t stepSamples;
+uint32_t stepRemainder;
+uint32_t stepDivisor = 1;
+uint32_t stepError = 0;
+
+// External sync state, only touched from interrupt context once running.
+// extStepUs is the smoothed length of one step in microseconds. Every edge
+// plays its step on the next sample, which keeps the phase locked to the
+// source, and the smoothed period only places the interpolated steps and the
+// tempo readout.
+uint8_t extStepsLeft = 0;
+uint16_t extStepSamples;
+uint16_t extStepLatched;
+volatile uint8_t extEdges = 0;
+volatile uint8_t extEdgeSteps = 1;
+uint8_t extEdgesSeen = 0;
+uint32_t extStepUs = 0;
+uint32_t lastPulseUs;
+uint32_t lastTickUs;
+uint8_t midiTick = 0;
+bool midiRunning = false;
+
+#define SYNC_GLITCH_US     2000      // ignore pulses closer than this
+#define SYNC_TIMEOUT_US    1000000UL // 30 BPM at two pulses per beat
+#define MIDI_TIMEOUT_US    250000UL  // 10 BPM at 24 PPQN
+
+// Samples per microsecond (F_CPU/510/1000000) as a 16 bit fraction
+#define SAMPLES_PER_US_Q16 (uint32_t)((F_CPU * 65536ULL) / (SAMPLE_DIVIDER * 1000000ULL))
+
+// Returns false, leaving the tempo as it was, for one whose step doesn't fit
+// stepSamples
+bool setTempo(int bpm){
+  if(bpm <= 0){return false;}
+  uint32_t divisor = (uint32_t)SAMPLE_DIVIDER * bpm;
+  if((F_CPU * 15UL) / divisor > 0xFFFF){return false;}
+  uint16_t samples = (F_CPU * 15UL) / divisor;
+  uint32_t remainder = (F_CPU * 15UL) % divisor;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    stepSamples = samples;
+    stepRemainder = remainder;
+    stepDivisor = divisor;
+    if(stepError >= divisor){stepError = 0;}
+    if(stepCountdown > samples){stepCountdown = samples;}
+  }
+  return true;
+}
+
+void setClockSource(bool external){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    extSync = external;
+    extStepsLeft = 0;
+    extEdgesSeen = extEdges;
+    stepError = 0;
+    // The internal countdown free-runs, the external one waits for an edge
+    stepCountdown = external ? 0 : stepSamples;
+  }
+}
+
+// Smoothed tempo of the external clock in BPM, 0 until one has been seen
+int externalTempo(){
+  uint32_t step_us;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    step_us = extStepUs;
+  }
+  if(step_us == 0){return 0;}
+  return (15000000UL + step_us / 2) / step_us;
+}
+
+// First order PLL style filter: follow the measured step length with a 1/4
+// gain, but jump straight to it when the tempo changed by more than 2x.
+static void trackStep(uint32_t step_us){
+  if(extStepUs == 0 || step_us > 2 * extStepUs || 2 * step_us < extStepUs){
+    extStepUs = step_us;
+  }
+  else{
+    extStepUs += ((int32_t)(step_us - extStepUs)) >> 2;
+  }
+  extStepSamples = (extStepUs * SAMPLES_PER_US_Q16) >> 16;
+}
+
+// Clock edge from either source, picked up by clockTick() on the next sample
+static void countEdge(uint8_t steps){
+  if(!extSync){return;}
+  extEdgeSteps = steps;
+  extEdges++;
+}
+
+// Sync pulses on pin 11 (PB5 / PCINT5)
+ISR(PCINT0_vect){
+  if(!(PINB & _BV(PB5))){return;}   // rising edges only
+  uint32_t now = micros();
+  uint32_t period = now - lastPulseUs;
+  if(period < SYNC_GLITCH_US){return;}
+  lastPulseUs = now;
+  if(period < SYNC_TIMEOUT_US){trackStep(period / SYNC_STEPS_PER_PULSE);}
+  countEdge(SYNC_STEPS_PER_PULSE);
+}
+
+// MIDI real time messages, handed over by the USART1 receive interrupt
+// (midi.cpp) the moment they arrive
+void clockMidi(uint8_t data){
+  switch(data){
+    case 0xF8: {   // timing clock
+      uint32_t now = micros();
+      uint32_t period = now - lastTickUs;
+      lastTickUs = now;
+      if(period < MIDI_TIMEOUT_US){trackStep(period * MIDI_TICKS_PER_STEP);}
+      if(midiRunning){
+        if(midiTick == 0){countEdge(1);}
+        if(++midiTick == MIDI_TICKS_PER_STEP){midiTick = 0;}
+      }
+      break;
+    }
+    case 0xFA:     // start, the next tick is step 1
+      midiTick = 0;
+      midiRunning = true;
+      clockRestart = true;
+      break;
+    case 0xFB:     // continue
+      midiRunning = true;
+      break;
+    case 0xFC:     // stop
+      midiRunning = false;
+      break;
+  }
+}
+
+void clockBegin(){
+  pinMode(SYNC_PIN, INPUT);
+  PCMSK0 |= _BV(PCINT5);
+  PCICR |= _BV(PCIE0);
+}
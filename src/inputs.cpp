@@ -0,0 +1,87 @@
+#include "inputs.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// The XMEM bus drives ports A and C, the scan below would read its traffic
+// as buttons. Move the panel to other ports before lifting this.
+#ifdef DELAY_XMEM
+#error "DELAY_XMEM takes over ports A and C, where the buttons and switches are"
+#endif
+
+// PA1 and PA3 (pins 23 and 25) are not wired up
+#define INPUT_MASK_A 0xF5
+#define INPUT_MASK_C 0xFF
+#define INPUT_MASK   ((uint16_t)INPUT_MASK_C << 8 | INPUT_MASK_A)
+
+static volatile uint16_t inputState = 0;   // debounced, 1 = down
+static uint16_t count0 = 0xFFFF, count1 = 0xFFFF;
+
+// Single producer (timer interrupt) / single consumer (loop) ring, each
+// index is only written by its owner
+static volatile uint8_t queue[INPUT_QUEUE];
+static volatile uint8_t queueHead = 0;
+static volatile uint8_t queueTail = 0;
+
+static void pushEvent(uint8_t event){
+  uint8_t next = (queueHead + 1) & (INPUT_QUEUE - 1);
+  if(next == queueTail){return;}   // full, loop() is badly behind anyway
+  queue[queueHead] = event;
+  queueHead = next;
+}
+
+// Runs with interrupts enabled so it never holds up the audio interrupt
+ISR(TIMER5_COMPA_vect, ISR_NOBLOCK){
+  uint16_t raw = ~(PINA | (uint16_t)PINC << 8) & INPUT_MASK;
+  uint16_t state = inputState;
+
+  // Vertical counter: every bit that differs from the debounced state counts
+  // up, every bit that agrees is reset. A bit that reaches four flips.
+  uint16_t delta = state ^ raw;
+  count0 = ~(count0 & delta);
+  count1 = count0 ^ (count1 & delta);
+  uint16_t toggled = delta & count0 & count1;
+  if(!toggled){return;}
+
+  state ^= toggled;
+  inputState = state;
+  for(uint8_t in = 0; toggled; in++, toggled >>= 1){
+    if(toggled & 1){
+      pushEvent((state & INPUT_BIT(in)) ? in : (in | INPUT_RELEASED));
+    }
+  }
+}
+
+void inputBegin(){
+  DDRA &= ~INPUT_MASK_A;
+  PORTA |= INPUT_MASK_A;    // pull-ups
+  DDRC &= ~INPUT_MASK_C;
+  PORTC |= INPUT_MASK_C;
+
+  // Start from whatever is held at power up without reporting it as presses
+  inputState = ~(PINA | (uint16_t)PINC << 8) & INPUT_MASK;
+
+  // Timer 5, CTC, 16MHz / 64 / 250 = 1kHz
+  TCCR5A = 0;
+  TCCR5B = _BV(WGM52) | _BV(CS51) | _BV(CS50);
+  OCR5A = 249;
+  TIMSK5 |= _BV(OCIE5A);
+}
+
+// Next queued event, INPUT_NONE when there is none
+uint8_t inputEvent(){
+  uint8_t tail = queueTail;
+  if(tail == queueHead){return INPUT_NONE;}
+  uint8_t event = queue[tail];
+  queueTail = (tail + 1) & (INPUT_QUEUE - 1);
+  return event;
+}
+
+bool inputDown(uint8_t in){
+  uint16_t a, b;
+  do{
+    a = inputState;
+    b = inputState;
+  }while(a != b);
+  return a & INPUT_BIT(in);
+}
@@ -0,0 +1,136 @@
+#include "lcd.h"
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#define LCD_CELLS     (LCD_COLS * LCD_ROWS)
+#define LCD_NOWHERE   0xFF
+
+// HD44780 commands
+#define LCD_CLEAR         0x01
+#define LCD_ENTRY_RIGHT   0x06    // cursor moves right, no shift
+#define LCD_DISPLAY_ON    0x0C    // no cursor, no blink
+#define LCD_4BIT_2LINE    0x28
+#define LCD_SET_DDRAM     0x80
+
+// RS, EN, D4-D7
+static const uint8_t lcdPins[6] = {LCD_RS, LCD_EN, LCD_D4, LCD_D5, LCD_D6, LCD_D7};
+static volatile uint8_t *lcdPort[6];
+static uint8_t lcdMask[6];
+
+// shadow is written by loop() only, shown by the interrupt only, so neither
+// needs a lock: a cell the interrupt reads mid change just goes out again
+// on a later tick.
+static char shadow[LCD_CELLS];
+static char shown[LCD_CELLS];
+static uint8_t cursor = 0;              // next shadow cell written, LCD_CELLS when off the row
+static uint8_t scan = 0;                // cell the interrupt looks at first
+static uint8_t address = LCD_NOWHERE;   // cell the display's address counter is on
+
+// Port writes shared with loop() and the audio interrupt, so each one is a
+// short atomic read-modify-write
+static void pinWrite(uint8_t pin, bool high){
+  uint8_t sreg = SREG;
+  cli();
+  if(high){*lcdPort[pin] |= lcdMask[pin];}
+  else{*lcdPort[pin] &= ~lcdMask[pin];}
+  SREG = sreg;
+}
+
+static void lcdNibble(uint8_t n){
+  for(uint8_t i = 0; i < 4; i++){pinWrite(2 + i, n & (1 << i));}
+  pinWrite(1, true);
+  _delay_us(1);
+  pinWrite(1, false);
+}
+
+static void lcdByte(uint8_t b, bool data){
+  pinWrite(0, data);
+  lcdNibble(b >> 4);
+  lcdNibble(b & 0x0F);
+}
+
+// DDRAM address of a cell, rows start at 0x00 and 0x40
+static uint8_t cellAddress(uint8_t cell){
+  return (cell < LCD_COLS) ? cell : 0x40 + cell - LCD_COLS;
+}
+
+// One command or character per tick, at the first cell from scan that the
+// display has wrong. Runs with interrupts enabled like the input scanner.
+ISR(TIMER5_COMPB_vect, ISR_NOBLOCK){
+  for(uint8_t n = 0; n < LCD_CELLS; n++){
+    uint8_t cell = scan;
+    char c = shadow[cell];
+    if(c != shown[cell]){
+      if(cell != address){
+        // Move the address counter this tick, write the cell the next
+        lcdByte(LCD_SET_DDRAM | cellAddress(cell), false);
+        address = cell;
+        return;
+      }
+      lcdByte(c, true);
+      shown[cell] = c;
+      // The counter runs on along the row but not from one row to the next
+      address = ((cell + 1) % LCD_COLS) ? cell + 1 : LCD_NOWHERE;
+      scan = (cell + 1 == LCD_CELLS) ? 0 : cell + 1;
+      return;
+    }
+    scan = (cell + 1 == LCD_CELLS) ? 0 : cell + 1;
+  }
+}
+
+// The power up sequence still waits, so setup() only
+void LcdScreen::begin(){
+  for(uint8_t i = 0; i < 6; i++){
+    lcdPort[i] = portOutputRegister(digitalPinToPort(lcdPins[i]));
+    lcdMask[i] = digitalPinToBitMask(lcdPins[i]);
+    pinMode(lcdPins[i], OUTPUT);
+    pinWrite(i, false);
+  }
+
+  // Into 4 bit mode from whatever state it is in
+  _delay_ms(50);
+  lcdNibble(0x3);
+  _delay_ms(5);
+  lcdNibble(0x3);
+  _delay_us(150);
+  lcdNibble(0x3);
+  _delay_us(150);
+  lcdNibble(0x2);
+  _delay_us(50);
+  lcdByte(LCD_4BIT_2LINE, false);
+  _delay_us(50);
+  lcdByte(LCD_DISPLAY_ON, false);
+  _delay_us(50);
+  lcdByte(LCD_CLEAR, false);
+  _delay_ms(2);
+  lcdByte(LCD_ENTRY_RIGHT, false);
+  _delay_us(50);
+
+  memset(shadow, ' ', sizeof(shadow));
+  memset(shown, ' ', sizeof(shown));
+  cursor = 0;
+  address = 0;
+
+  // Half way between two input scans
+  OCR5B = 124;
+  TIMSK5 |= _BV(OCIE5B);
+}
+
+void LcdScreen::clear(){
+  memset(shadow, ' ', sizeof(shadow));
+  cursor = 0;
+}
+
+void LcdScreen::setCursor(uint8_t col, uint8_t row){
+  cursor = (col < LCD_COLS && row < LCD_ROWS) ? row * LCD_COLS + col : LCD_CELLS;
+}
+
+size_t LcdScreen::write(uint8_t c){
+  if(cursor >= LCD_CELLS){return 0;}
+  shadow[cursor] = c;
+  cursor = ((cursor + 1) % LCD_COLS) ? cursor + 1 : LCD_CELLS;
+  return 1;
+}
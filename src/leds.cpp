@@ -0,0 +1,47 @@
+#include "leds.h"
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+// The XMEM bus drives PG0-2 as its strobes, the step LEDs there would fight
+// it. Move them to other pins before lifting this.
+#ifdef DELAY_XMEM
+#error "DELAY_XMEM takes over PG0-2, where three step LEDs are"
+#endif
+
+uint16_t ledFrame = 0;
+
+// Spreads a nibble onto the even bits of a byte
+static const uint8_t spreadNibble[16] PROGMEM = {
+  0x00,0x01,0x04,0x05,0x10,0x11,0x14,0x15,0x40,0x41,0x44,0x45,0x50,0x51,0x54,0x55
+};
+
+void ledBegin(){
+  DDRB |= 0x0F;
+  DDRL = 0xFF;
+  DDRG |= 0x07;
+  DDRD |= 0x80;
+  ledFrame = 0xFFFF;
+  ledShow(0);
+}
+
+void ledShow(uint16_t frame){
+  if(frame == ledFrame){return;}
+  ledFrame = frame;
+
+  uint8_t top = frame;
+  uint8_t bottom = frame >> 8;
+  // Steps 1, 9, 2, 10, 3, 11, 4, 12 and steps 5, 13, 6, 14, 7, 15, 8, 16
+  uint8_t first = pgm_read_byte(&spreadNibble[top & 0x0F]) | (pgm_read_byte(&spreadNibble[bottom & 0x0F]) << 1);
+  uint8_t second = pgm_read_byte(&spreadNibble[top >> 4]) | (pgm_read_byte(&spreadNibble[bottom >> 4]) << 1);
+
+  PORTL = (first >> 4) | (second << 4);
+  // The audio interrupt toggles PB7 and the LCD interrupt drives pins on PORTG,
+  // don't let either land inside a read-modify-write
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    PORTG = (PORTG & ~0x07) | ((second >> 4) & 0x07);
+    PORTD = (PORTD & ~0x80) | (second & 0x80);
+    PORTB = (PORTB & ~0x0F) | (first & 0x0F);
+  }
+}
@@ -11,18 +11,155 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <LiquidCrystal.h>
-
-uint16_t syncPhaseAcc;
-uint16_t syncPhaseInc;
-uint16_t grainPhaseAcc;
-uint16_t grainPhaseInc;
-uint16_t grainAmp;
-uint8_t grainDecay;
-uint16_t grain2PhaseAcc;
-uint16_t grain2PhaseInc;
-uint16_t grain2Amp;
-uint8_t grain2Decay;
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "adc_scan.h"
+#include "bank.h"
+#include "bus_filter.h"
+#include "clock.h"
+#include "fixmath.h"
+#include "grain_delay.h"
+#include "grain_engine.h"
+#include "inputs.h"
+#include "lcd.h"
+#include "leds.h"
+#include "memstats.h"
+#include "midi.h"
+#include "quantizer.h"
+#include "telemetry.h"
+#include "wavetables.h"
+
+// The synth voices played by the PWM interrupt
+GrainEngine<GRAIN_VOICES> synth;
+// and the filter on their mix
+BusFilter busFilter;
+
+// Voice parameter block handed from loop() to the audio interrupt. loop() only
+// ever fills the back buffer and then publishes it by flipping voiceFront, a
+// single byte write. The interrupt latches the front buffer into its voice
+// at that voice's next grain boundary, so it never sees a half-written 16 bit
+// increment and parameter changes land between grains instead of inside one.
+// A trigger for a voice that has gone silent (grain_engine.h) doesn't wait:
+// it latches on the next sample and restarts the voice, so a slow sync on a
+// voice that has nothing left to play can't hold the step back. A trigger
+// for a voice still fading out waits for the boundary like any update.
+//
+// A trigger also carries the timing of the step's hits, which the interrupt
+// counts out sample by sample from the moment it latches: the ratchets after
+// the first hit, hitSamples apart, and the gate that releases the voice
+// gateSamples into every hit. loop() works all of it out per step, the
+// interrupt only counts down.
+//
+// The bus filter takes the filter of a step along with its voice, so the
+// two change together.
+struct VoiceBlock {
+  VoiceParams params;
+  VoiceSlide slide;
+  FilterParams filter;
+  uint8_t voice;        // engine voice the parameters go to
+  bool trigger;         // start a new step on it, or just change its sound
+  bool release;         // or end the note playing on it
+  uint8_t ratchets;     // hits after the first
+  uint16_t hitSamples;
+  uint16_t gateSamples; // 0 to hold the note
+};
+VoiceBlock voiceBlocks[2];
+volatile uint8_t voiceFront = 0;
+volatile bool voicePending = false;
+uint8_t voiceLast = 0;  // voice the last step was sent to
+
+// Hits of the last step still to come, counted down by the audio interrupt
+uint8_t hitVoice;
+uint8_t hitsLeft = 0;
+uint16_t hitSamples;
+uint16_t hitCountdown;
+uint16_t gateSamples;
+uint16_t gateCountdown = 0;
+
+// The buffer loop() may write into
+inline VoiceBlock &voiceBack() {
+  return voiceBlocks[voiceFront ^ 1];
+}
+
+// The flip and the pending flag go together: were the interrupt to latch the
+// new front in between, setting the flag after it would have it latched again.
+// Called with interrupts off.
+inline void flipVoice() {
+  asm volatile("" ::: "memory"); // keep the buffer stores ahead of the flip
+  voiceFront ^= 1;
+  voicePending = true;
+}
+
+// Hand the back buffer over to the audio interrupt. A trigger goes to the next 
+// voice round robin, an update to the voice of the last step. If a trigger is 
+// still waiting to be latched the new block carries it along, so an update 
+// right behind a step can't swallow the step. The check and the flip are one 
+// atomic step, so a trigger latched in the meantime isn't carried and played twice.
+inline void publishVoice(bool trigger) {
+  VoiceBlock &b = voiceBack();
+  b.release = false;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (voicePending && voiceBlocks[voiceFront].trigger) {
+      const VoiceBlock &f = voiceBlocks[voiceFront];
+      trigger = true;
+      b.ratchets = f.ratchets;
+      b.hitSamples = f.hitSamples;
+      b.gateSamples = f.gateSamples;
+    }
+    else if (trigger) {
+      voiceLast = (voiceLast + 1 == GRAIN_VOICES) ? 0 : voiceLast + 1;
+    }
+    b.voice = voiceLast;
+    b.trigger = trigger;
+    flipVoice();
+  }
+}
+
+// End the note of the last step
+inline void publishRelease() {
+  VoiceBlock &b = voiceBack();
+  b.voice = voiceLast;
+  b.trigger = false;
+  b.release = true;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    flipVoice();
+  }
+}
+
+// Called from the audio interrupt only
+inline void latchVoice() {
+  const VoiceBlock &b = voiceBlocks[voiceFront];
+  if (b.trigger) {
+    synth.trigger(b.voice, b.params, b.slide);
+    busFilter.set(b.filter);
+    hitVoice = b.voice;
+    hitsLeft = b.ratchets;
+    hitSamples = hitCountdown = b.hitSamples;
+    gateSamples = gateCountdown = b.gateSamples;
+  }
+  else if (b.release) {
+    synth.release(b.voice);
+    hitsLeft = 0;
+    gateCountdown = 0;
+  }
+  else {
+    synth.update(b.voice, b.params, b.slide);
+    busFilter.set(b.filter);
+  }
+  voicePending = false;
+}
+
+// Ratchets and gates of the step playing, once per sample from the audio interrupt
+inline void hitTick() {
+  if (gateCountdown && --gateCountdown == 0) synth.release(hitVoice);
+  if (hitsLeft && --hitCountdown == 0) {
+    hitsLeft--;
+    hitCountdown = hitSamples;
+    gateCountdown = gateSamples;
+    synth.retrigger(hitVoice);
+  }
+}
 
 // Map Analogue channels
 #define SYNC_CONTROL         (4)
@@ -56,6 +193,7 @@ uint8_t grain2Decay;
 #define PWM_PIN       13
 #define PWM_VALUE     OCR3C
 #define PWM_INTERRUPT TIMER3_OVF_vect
+#define RENDER_INTERRUPT TIMER3_COMPA_vect
 #else
 //
 // For modern ATmega168 and ATmega328 boards
@@ -71,45 +209,47 @@ uint8_t grain2Decay;
 
 // Smooth logarithmic mapping
 //
-uint16_t antilogTable[] = {
+const uint16_t antilogTable[] PROGMEM = {
   64830,64132,63441,62757,62081,61413,60751,60097,59449,58809,58176,57549,56929,56316,55709,55109,
   54515,53928,53347,52773,52204,51642,51085,50535,49991,49452,48920,48393,47871,47356,46846,46341,
   45842,45348,44859,44376,43898,43425,42958,42495,42037,41584,41136,40693,40255,39821,39392,38968,
   38548,38133,37722,37316,36914,36516,36123,35734,35349,34968,34591,34219,33850,33486,33125,32768
 };
 uint16_t mapPhaseInc(uint16_t input) {
-  return (antilogTable[input & 0x3f]) >> (input >> 6);
+  return (pgm_read_word(&antilogTable[input & 0x3f])) >> (input >> 6);
 }
 
-// Stepped chromatic mapping
-//
-uint16_t midiTable[] = {
-  17,18,19,20,22,23,24,26,27,29,31,32,34,36,38,41,43,46,48,51,54,58,61,65,69,73,
-  77,82,86,92,97,103,109,115,122,129,137,145,154,163,173,183,194,206,218,231,
-  244,259,274,291,308,326,346,366,388,411,435,461,489,518,549,581,616,652,691,
-  732,776,822,871,923,978,1036,1097,1163,1232,1305,1383,1465,1552,1644,1742,
-  1845,1955,2071,2195,2325,2463,2610,2765,2930,3104,3288,3484,3691,3910,4143,
-  4389,4650,4927,5220,5530,5859,6207,6577,6968,7382,7821,8286,8779,9301,9854,
-  10440,11060,11718,12415,13153,13935,14764,15642,16572,17557,18601,19708,20879,
-  22121,23436,24830,26306
-};
-uint16_t mapMidi(uint16_t input) {
-  return (midiTable[(1023-input) >> 3]);
-}
+// Stepped mapping of the sync pot onto the notes of a scale, see quantizer.h
 
-// Stepped Pentatonic mapping
-//
-uint16_t pentatonicTable[54] = {
-  0,19,22,26,29,32,38,43,51,58,65,77,86,103,115,129,154,173,206,231,259,308,346,
-  411,461,518,616,691,822,923,1036,1232,1383,1644,1845,2071,2463,2765,3288,
-  3691,4143,4927,5530,6577,7382,8286,9854,11060,13153,14764,16572,19708,22121,26306
-};
 
-uint16_t mapPentatonic(uint16_t input) {
-  uint8_t value = (1023-input) / (1024/53);
-  return (pentatonicTable[value]);
-}
+/* Audio rendering. With AUDIO_BLOCK set, samples are rendered AUDIO_BLOCK at a time 
+into a FIFO of two blocks and the PWM overflow interrupt only pops one byte per sample. 
+Each time it has emptied a block it raises the render interrupt (Timer 3 compare A, which 
+otherwise stays masked). That one re-enables interrupts straight away, so the overflow 
+keeps playing on time from the other half while the block is computed, and the register 
+save/restore and the state loads are paid once per block instead of once per sample. 
+The extra latency is one block, 0.5ms at 16.
 
+AUDIO_BLOCK 0 renders every sample inside the overflow interrupt, as the original sketch 
+did. Only the Mega has the spare compare interrupt on the PWM timer. */
+#ifndef AUDIO_BLOCK
+#if defined(RENDER_INTERRUPT)
+#define AUDIO_BLOCK 16
+#else
+#define AUDIO_BLOCK 0
+#endif
+#endif
+
+#if AUDIO_BLOCK
+#define AUDIO_FIFO (2 * AUDIO_BLOCK)
+#if AUDIO_BLOCK & (AUDIO_BLOCK - 1) || AUDIO_FIFO > 256
+#error "AUDIO_BLOCK must be a power of two, at most 128"
+#endif
+uint8_t audioFifo[AUDIO_FIFO];
+uint8_t audioHead = 0;         // first sample of the half to render next
+uint8_t audioTail = 0;         // next sample to play
+bool audioRendering = false;
+#endif
 
 void audioOn() {
 #if defined(__AVR_ATmega8__)
@@ -119,6 +259,7 @@ void audioOn() {
 #elif defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
   TCCR3A = _BV(COM3C1) | _BV(WGM30);
   TCCR3B = _BV(CS30);
+  OCR3A = 128;  // any value will do, compare A only serves as the render interrupt
   TIMSK3 = _BV(TOIE3);
 #else
   // Set up PWM to 31.25kHz, phase accurate
@@ -130,270 +271,972 @@ void audioOn() {
 
 int current_tempo = 120;
 int previous_tempo = 120;
+int previous_ext_tempo = 0;
 int pattern = 0;
-int counter = 0;
-long ms_clock = 0;
-long prev_tmstmp = 0;
 // long bpm = 120;
 // long tempo = 1000/(bpm/60);
 // long prevmillis = 0;
 // long interval = tempo/24;    //interval is the number of milliseconds defined by tempo formula.
 
+// Steps taken by loop(), chasing stepsRaised from the clock
+uint8_t stepsTaken = 0;
+
+/* Patterns. The one playing and the one being loaded from the bank (bank.h) sit in 
+two buffers, and steps points at the steps of the playing one. A pattern picked with 
+button 33 and a step button loads in the background and takes over on the first bar 
+boundary after it is in, so the switch always lands on step 1. Everything edited is 
+saved by itself once it has been left alone for BANK_SETTLE_MS. */
+#define BANK_SETTLE_MS 2000
+
+Pattern patterns[2];
+Pattern *playing = &patterns[0];
+Step *steps = playing->steps;
+uint8_t pattern_num = 0;          // bank number of the playing pattern
+int pattern_next = -1;            // bank number queued to play next, -1 for none
+uint32_t bank_dirty = 0;          // steps (bits 0-15) and settings (bit 16) not saved yet
+unsigned long bank_changed = 0;
 
-bool int_clock = false;
-bool ext_clock = false;
-bool chosen_clock = false;
-
-int a1 = 0; int a2 = 0; int a3 = 0; int a4 = 0; int a5 = 0; 
-int b1 = 0; int b2 = 0; int b3 = 0; int b4 = 0; int b5 = 0; 
-int c1 = 0; int c2 = 0; int c3 = 0; int c4 = 0; int c5 = 0; 
-int d1 = 0; int d2 = 0; int d3 = 0; int d4 = 0; int d5 = 0; 
-int e1 = 0; int e2 = 0; int e3 = 0; int e4 = 0; int e5 = 0; 
-int f1 = 0; int f2 = 0; int f3 = 0; int f4 = 0; int f5 = 0; 
-int g1 = 0; int g2 = 0; int g3 = 0; int g4 = 0; int g5 = 0; 
-int h1 = 0; int h2 = 0; int h3 = 0; int h4 = 0; int h5 = 0; 
-int i1 = 0; int i2 = 0; int i3 = 0; int i4 = 0; int i5 = 0; 
-int j1 = 0; int j2 = 0; int j3 = 0; int j4 = 0; int j5 = 0; 
-int k1 = 0; int k2 = 0; int k3 = 0; int k4 = 0; int k5 = 0; 
-int l1 = 0; int l2 = 0; int l3 = 0; int l4 = 0; int l5 = 0; 
-int m1 = 0; int m2 = 0; int m3 = 0; int m4 = 0; int m5 = 0; 
-int n1 = 0; int n2 = 0; int n3 = 0; int n4 = 0; int n5 = 0; 
-int o1 = 0; int o2 = 0; int o3 = 0; int o4 = 0; int o5 = 0; 
-int p1 = 0; int p2 = 0; int p3 = 0; int p4 = 0; int p5 = 0;
+/* Song mode (bank.h). Holding button 33, the step buttons of steps 9-16 (switch 29) start 
+the song from entry 1-8 at the next bar, and picking a pattern leaves it. The song plays 
+every entry for its bars and then goes round again from the first. While the last step 
+of a bar plays, the pattern of the entry coming next is loaded into the spare buffer, so 
+at the bar boundary it takes over with the same pointer flip as a pattern picked by hand. 
+One that isn't in by then (an edit of the old one still saving) waits for the next bar 
+rather than cut in late. The song itself is set over MIDI. */
+Song song;
+bool song_on = false;
+uint8_t song_pos = 0;             // entry playing
+uint8_t song_left = 0;            // bars of it left, the one playing included
+int song_next = -1;               // entry to go to at the next bar, -1 for none yet
+uint8_t song_dirty = 0;           // parts of the song not saved yet, a bit each
+
+// The eight step buttons (pins 30,32,34,36,22,24,26,28) edit steps 1-8 or 
+// 9-16 depending on switch 29
+const byte stepButtons[8] = {IN_PIN30,IN_PIN32,IN_PIN34,IN_PIN36,IN_PIN22,IN_PIN24,IN_PIN26,IN_PIN28};
 
 int live_sync_phase = 0;
 int live_grain_phase = 0;
 int live_grain_decay = 0;
 int live_grain2_phase = 0;
 int live_grain2_decay = 0;
+int live_cutoff = 0;
 
-#define MAX_DELAY 2048
-unsigned char sDelayBuffer[MAX_DELAY];
-unsigned int nDelayCounter = 0;
-unsigned char bDelay;
+/* The delay. Its line lives in internal RAM, or with DELAY_XMEM in external RAM on
+the Mega's XMEM bus, enabled in setup(). The bus takes over ports A and C and PG0-2,
+which on this panel carry the buttons, the switches and three step LEDs, so an XMEM
+build needs the panel moved to other pins. Until then inputs.cpp and leds.cpp refuse
+to build with it. */
+GrainDelay<DELAY_BITS, DELAY_PACK, DELAY_DECIMATE, DELAY_TAPS> echo;
+#ifdef DELAY_XMEM
+#define DELAY_RAM ((uint8_t *)0x8000)
+#else
+uint8_t delayRam[DELAY_BYTES];
+#define DELAY_RAM delayRam
+#endif
 
 int current_steps = 8;
 int previous_steps = 8;
 
-LiquidCrystal lcd(1, 2, 4, 5, 6, 7);
+LcdScreen lcd;
 
 
 //BUTTON MANAGEMENT
-#define DEBOUNCE 2  // button debouncer, how many ms to debounce, 5+ ms is usually plenty
+// Debouncing happens in the input scanner (inputs.cpp), check_switches() just
+// drains its event queue once per pass of loop().
 // here is where we define the buttons that we'll use. button "1" is the first, button "6" is the 6th, etc
-byte buttons[] = {37,35,33}; // the analog 0-5 pins are also known as 14-19
+byte buttons[] = {IN_PIN37,IN_PIN35,IN_PIN33};
 // This handy macro lets us determine how big the array up above is, by checking the size
 #define NUMBUTTONS sizeof(buttons)
 // we will track if a button is just pressed, just released, or 'currently pressed' 
 byte pressed[NUMBUTTONS], justpressed[NUMBUTTONS], justreleased[NUMBUTTONS];
+// step (1-16) whose button was just pressed, 0 if none
+int step_pressed = 0;
 
 void check_switches()
 {
-  static byte previousstate[NUMBUTTONS];
-  static byte currentstate[NUMBUTTONS];
-  static long lasttime;
   byte index;
+  byte event;
 
-  if (millis() < lasttime){ // we wrapped around, lets just try again
-     lasttime = millis();
-  }
-  
-  if ((lasttime + DEBOUNCE) > millis()) {
-    // not enough time has passed to debounce
-    return; 
-  }
-  // ok we have waited DEBOUNCE milliseconds, lets reset the timer
-  lasttime = millis();
-  
   for (index = 0; index < NUMBUTTONS; index++){ // when we start, we clear out the "just" indicators
     justpressed[index] = 0;
     justreleased[index] = 0; 
-    currentstate[index] = digitalRead(buttons[index]);   // read the button
-     
-    if (currentstate[index] == previousstate[index]) {
-      if ((pressed[index] == LOW) && (currentstate[index] == LOW)) {
-          // just pressed
-          justpressed[index] = 1;
+  }
+  step_pressed = 0;
+
+  while ((event = inputEvent()) != INPUT_NONE){
+    byte in = event & ~INPUT_RELEASED;
+    bool down = !(event & INPUT_RELEASED);
+
+    for (index = 0; index < NUMBUTTONS; index++){
+      if (buttons[index] == in){
+        pressed[index] = down;
+        if (down) justpressed[index] = 1;
+        else justreleased[index] = 1;
       }
-      else if ((pressed[index] == HIGH) && (currentstate[index] == HIGH)) {
-          // just released
-          justreleased[index] = 1;
+    }
+    for (index = 0; index < 8 && down; index++){
+      if (stepButtons[index] == in){
+        step_pressed = (inputDown(IN_PIN29) ? 1 : 9) + index;
       }
-      pressed[index] = !currentstate[index];  // remember, digital HIGH means NOT pressed
     }
-    //Serial.println(pressed[index], DEC);
-    previousstate[index] = currentstate[index];   // keep a running tally of the buttons
   }
 }
 
+#ifdef ISR_BENCH
+// Fixed pattern for the simavr interrupt benchmark (tools/isrbench). The 16 steps 
+// cover every pairing of four sync rates with four grain frequencies, each hit 
+// four times at 180 BPM.
+void loadBenchPattern(){
+  static const uint16_t sync[4] = {19, 115, 923, 7382};
+  static const uint16_t grain[4] = {500, 4000, 16000, 40000};
+  for(byte i = 0; i < NUMSTEPS; i++){
+    steps[i].syncPhaseInc = sync[i >> 2];
+    steps[i].grainPhaseInc = grain[i & 3];
+    steps[i].grainDecay = 8;
+    steps[i].grain2PhaseInc = grain[3 - (i & 3)];
+    steps[i].grain2Decay = 16;
+    steps[i].ratchet = 3;
+    // The filter on every step, all three outputs cost the same
+    steps[i].filter = FILTER_LOW + i % 3;
+    steps[i].cutoff = i * 4;
+    steps[i].resonance = 15;
+  }
+  current_steps = NUMSTEPS;
+  current_tempo = 180;
+}
+#endif
+
 void setup() {
 
-  lcd.begin(16,2);
+  lcd.begin();
+
+  // Pattern 1 comes up as it was left
+  bankBegin();
+  bankLoad(0, playing);
+  while(bankLoading()){bankTask();}
+  current_steps = previous_steps = playing->length;
+  current_tempo = previous_tempo = playing->tempo;
+  bankLoadSong(song);
+
+#ifdef ISR_BENCH
+  loadBenchPattern();
+#endif
+
+#ifdef DELAY_XMEM
+  // External RAM on, all 16 address lines, no wait states
+  XMCRA = _BV(SRE);
+  XMCRB = 0;
+#endif
+  echo.begin(DELAY_RAM);
+
+  adcBegin();
+  setTempo(current_tempo);
+  clockBegin();
+  midiBegin();
 
   pinMode(PWM_PIN,OUTPUT);
   audioOn();
   pinMode(LED_PIN,OUTPUT);
   
-  //FIRST ROW 8 LED'S
-  pinMode(39, OUTPUT); digitalWrite(39, LOW);
-  pinMode(41, OUTPUT); digitalWrite(41, LOW);
-  pinMode(43, OUTPUT); digitalWrite(43, LOW);
-  pinMode(45, OUTPUT); digitalWrite(45, LOW);
-  pinMode(47, OUTPUT); digitalWrite(47, LOW);
-  pinMode(49, OUTPUT); digitalWrite(49, LOW);
-  pinMode(51, OUTPUT); digitalWrite(51, LOW);
-  pinMode(53, OUTPUT); digitalWrite(53, LOW);
-  //SECOND ROW 8 LED'S
-  pinMode(38, OUTPUT); digitalWrite(38, LOW);
-  pinMode(40, OUTPUT); digitalWrite(40, LOW);
-  pinMode(42, OUTPUT); digitalWrite(42, LOW);
-  pinMode(44, OUTPUT); digitalWrite(44, LOW);
-  pinMode(46, OUTPUT); digitalWrite(46, LOW);
-  pinMode(48, OUTPUT); digitalWrite(48, LOW);
-  pinMode(50, OUTPUT); digitalWrite(50, LOW);
-  pinMode(52, OUTPUT); digitalWrite(52, LOW);
-
-  //SECOND ROW BUTTONS
-  pinMode(22, INPUT_PULLUP); digitalWrite(22, HIGH);
-  pinMode(24, INPUT_PULLUP); digitalWrite(24, HIGH);
-  pinMode(26, INPUT_PULLUP); digitalWrite(26, HIGH);
-  pinMode(28, INPUT_PULLUP); digitalWrite(28, HIGH);
-
-  //FIRST ROW BUTTONS
-  pinMode(30, INPUT_PULLUP); digitalWrite(30, HIGH);
-  pinMode(32, INPUT_PULLUP); digitalWrite(32, HIGH);
-  pinMode(34, INPUT_PULLUP); digitalWrite(34, HIGH);
-  pinMode(36, INPUT_PULLUP); digitalWrite(36, HIGH);
-
-  //THIRD ROW BUTTONS
-  pinMode(37, INPUT_PULLUP); digitalWrite(37, HIGH);
-  pinMode(35, INPUT_PULLUP); digitalWrite(37, HIGH);
-  pinMode(33, INPUT_PULLUP); digitalWrite(35, HIGH);
-
-  //SWITCHES
-  pinMode(31, INPUT); digitalWrite(31, HIGH);
-  pinMode(29, INPUT); digitalWrite(29, HIGH);
-  pinMode(27, INPUT); digitalWrite(27, HIGH);
- 
+  //BOTH ROWS OF STEP LED'S
+  ledBegin();
+
+  //ALL BUTTONS AND SWITCHES
+  inputBegin();
+
+  telemetryBegin();
+}
+
+
+// Something in the playing pattern changed, save it once it has settled
+void markDirty(uint8_t index){
+  bank_dirty |= (uint32_t)1 << index;
+  bank_changed = millis();
+}
+
+Pattern *patternBack(){
+  return (playing == &patterns[0]) ? &patterns[1] : &patterns[0];
+}
 
+// Have pattern n (0-7) loaded into the spare buffer to play from the next bar
+void queuePattern(uint8_t n){
+  if(n == pattern_num){pattern_next = -1;}
+  else{
+    pattern_next = n;
+    bankLoad(n, patternBack());
+  }
+}
+
+// Ready to switch: loaded, nothing of the old pattern left unsaved and no 
+// MIDI dump of it still going out
+bool patternReady(){
+  return pattern_next >= 0 && !bankLoading() && !bank_dirty && !midiSending();
+}
+
+void switchPattern(){
+  playing = patternBack();
+  steps = playing->steps;
+  pattern_num = pattern_next;
+  pattern_next = -1;
+  current_steps = previous_steps = playing->length;
+  current_tempo = previous_tempo = playing->tempo;
+  setTempo(current_tempo);
+  lcd.clear();
+  lcd.print(F("Pattern "));
+  lcd.print(pattern_num + 1);
+}
+
+// A part of the song changed, save it once it has settled
+void markSongDirty(uint8_t part){
+  song_dirty |= 1 << part;
+  bank_changed = millis();
+}
+
+// Start the song from entry n at the next bar
+void songStart(uint8_t n){
+  lcd.clear();
+  if(n >= song.count){
+    lcd.print(song.count ? F("Song ends before") : F("No song"));
+    return;
+  }
+  song_on = true;
+  song_next = n;
+  queuePattern(song.entry[n].pattern);
+  lcd.print(F("Next song "));
+  lcd.print(n + 1);
+}
+
+// Back to the pattern as it is saved. The bar playing may be longer than that,
+// it wraps on the next step.
+void songStop(){
+  if(!song_on){return;}
+  song_on = false;
+  song_next = -1;
+  current_steps = previous_steps = playing->length;
+  current_tempo = previous_tempo = playing->tempo;
+  setTempo(current_tempo);
+}
+
+// Brings an entry from outside, a SysEx dump or the EEPROM, into range. The
+// pattern and bar count are bit fields and can't leave theirs.
+void songEntryCheck(SongEntry &e){
+  if(e.tempo){e.tempo = constrain(e.tempo, TEMPO_MIN, TEMPO_MAX);}
+  e.length = min(e.length, NUMSTEPS);
+}
+
+// On to entry n, its pattern is playing
+void songEnter(uint8_t n){
+  SongEntry &e = song.entry[n];
+  songEntryCheck(e);
+  song_pos = n;
+  song_left = e.repeats + 1;
+  song_next = -1;
+  current_steps = previous_steps = e.length ? e.length : playing->length;
+  current_tempo = previous_tempo = e.tempo ? e.tempo : playing->tempo;
+  setTempo(current_tempo);
+  lcd.clear();
+  lcd.print(F("Song ")); lcd.print(n + 1);
+  lcd.print('/'); lcd.print(song.count);
+  lcd.print(F(" P")); lcd.print(e.pattern + 1);
+}
+
+// The last step of a bar is playing: if the entry ends with it, fetch the next
+void songPrefetch(){
+  if(!song_on || song_next >= 0 || song_left > 1){return;}
+  song_next = (song_pos + 1 >= song.count) ? 0 : song_pos + 1;
+  queuePattern(song.entry[song_next].pattern);
+}
+
+// Bar boundary in song mode
+void songBar(){
+  if(song_next < 0){
+    if(song_left > 1){song_left--;}
+    return;
+  }
+  if(pattern_next >= 0){
+    if(!patternReady()){return;}
+    switchPattern();
+  }
+  songEnter(song_next);
+}
+
+// Queue pattern n (0-7) to play from the next bar, by hand
+void selectPattern(uint8_t n){
+  songStop();
+  queuePattern(n);
+  lcd.clear();
+  lcd.print(pattern_next >= 0 ? F("Next pattern ") : F("Pattern "));
+  lcd.print(n + 1);
+}
+
+// Save what has settled, everything at once if a switch is waiting for it
+void bankService(){
+  if(bank_dirty && (pattern_next >= 0 || millis() - bank_changed >= BANK_SETTLE_MS)){
+    for(uint8_t i = 0; i <= BANK_SETTINGS; i++){
+      uint32_t bit = (uint32_t)1 << i;
+      if((bank_dirty & bit) && bankSave(pattern_num, i, *playing)){bank_dirty &= ~bit;}
+    }
+  }
+  if(song_dirty && millis() - bank_changed >= BANK_SETTLE_MS){
+    for(uint8_t i = 0; i < SONG_PARTS; i++){
+      if((song_dirty & (1 << i)) && bankSaveSong(i, song)){song_dirty &= ~(1 << i);}
+    }
+  }
+  bankTask();
 }
 
+/* Step editor. Editing no longer traps the program in a loop: changeStep() only selects 
+the step, and editStep() runs a little every pass of loop() so the sequence, the clock and 
+the buttons keep going while a step is dialled in. The pots are sampled into editBuffer at 
+most every EDIT_SCAN_MS, editBuffer plays in place of the stored step whenever the playhead 
+is on it, and button 1 commits it. 
+Holding button 35 flips the pots over to how the step plays: chance, ratchets, length, 
+slide and tie, shown on the LCD. Holding 33 instead turns the two grain frequency pots 
+into the wavetable of each grain (wavetables.h) and the other three into the filter of 
+the step (bus_filter.h): mode, cutoff and resonance. Across a flip a pot only takes over once 
+it has been turned, so no page disturbs another. */
+#define EDIT_SCAN_MS 20
+#define EDIT_PICKUP 16
+#define EDIT_SOUND  0
+#define EDIT_PLAY   1
+#define EDIT_WAVE   2
+
+int edit_step = 0;              // step being edited (1-16), 0 when the editor is closed
+Step editBuffer;
+unsigned long last_edit_scan = 0;
+uint8_t edit_page = EDIT_SOUND;
+int edit_pots[5];               // pot readings at the last page flip
+uint8_t edit_moved = 0;         // pots turned since, a bit each
+
+// Step n (1-16) as it plays, the editor's copy while it is open
+const Step &stepAt(uint8_t n){
+  return (n == edit_step) ? editBuffer : steps[n-1];
+}
+
+/* MIDI transpose: the last note-on shifts every step's sync frequency by its distance 
+from middle C, up to two octaves either way, and stays until the next one. */
+#define MIDI_TRANSPOSE_ROOT 60
+
+int8_t transpose = 0;
+
+uint16_t transposeInc(uint16_t inc){
+  // 2^(n/12) for n = 0..11, Q15
+  static const uint16_t semitone[12] PROGMEM = {
+    32768,34716,36781,38968,41285,43740,46341,49097,52016,55109,58386,61858
+  };
+  if(transpose == 0){return inc;}
+  int8_t octave = (transpose + 24) / 12 - 2;
+  uint32_t r = ((uint32_t)inc * pgm_read_word(&semitone[(transpose + 24) % 12])) >> 15;
+  r = (octave >= 0) ? r << octave : r >> -octave;
+  return (r > 0xFFFF) ? 0xFFFF : r;
+}
+
+// Length of a step in samples, whichever clock is running
+uint16_t currentStepSamples(){
+  uint16_t step;
+  // 16 bit and shared with the interrupts
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    step = extSync ? extStepSamples : stepSamples;
+  }
+  return step;
+}
+
+/* How steps play (bank.h): the chance of a step is rolled on a 16 bit xorshift, and the 
+step is split into its hits by hit_samples[], worked out again only when the step length 
+changes, so a step costs no division unless it glides. */
+uint16_t rng_state = 0xACE1;
+uint16_t hit_samples[4];        // samples between hits, for 1 to 4 hits
+uint16_t hit_step = 0;          // step length they were worked out for
+uint16_t sent_sync = 0;         // sync and grain 1 frequencies last sent to the synth
+uint16_t sent_grain = 0;
+
+uint16_t xorshift(){
+  rng_state ^= rng_state << 7;
+  rng_state ^= rng_state >> 9;
+  rng_state ^= rng_state << 8;
+  return rng_state;
+}
+
+void updateHitSamples(){
+  uint16_t step = currentStepSamples();
+  if(step == hit_step){return;}
+  hit_step = step;
+  for(uint8_t i = 0; i < 4; i++){hit_samples[i] = step / (i + 1);}
+}
+
+// The synth parameters of a step, with the "live" offsets added. They saturate 
+// at the ends of each parameter rather than wrap round (fixmath.h).
+void stepParams(VoiceParams &v, const Step &s){
+  v.syncPhaseInc = transposeInc(satAddU16(s.syncPhaseInc, live_sync_phase)); v.grainPhaseInc = satAddU16(s.grainPhaseInc, live_grain_phase); 
+  v.grainDecay = satAddU8(s.grainDecay, live_grain_decay); v.grain2PhaseInc = satAddU16(s.grain2PhaseInc, live_grain2_phase);
+  v.grain2Decay = satAddU8(s.grain2Decay, live_grain2_decay);
+  v.grainWave = s.grainWave & (WAVES - 1); v.grain2Wave = s.grain2Wave & (WAVES - 1);
+  sent_sync = v.syncPhaseInc;
+  sent_grain = v.grainPhaseInc;
+}
+
+// The bus filter of a step, its cutoff swept by the live offset in table steps
+void stepFilter(FilterParams &f, const Step &s){
+  int cutoff = constrain((int)s.cutoff + live_cutoff, 0, FILTER_CUTOFFS - 1);
+  filterParams(f, s.filter, cutoff, s.resonance);
+}
+
+// Send a step to the synth as a single held note, no glide. With trigger set it 
+// starts on a fresh voice, otherwise it just changes the sound of the one playing.
+void playStep(const Step &s, bool trigger){
+  VoiceBlock &b = voiceBack();
+  stepParams(b.params, s);
+  stepFilter(b.filter, s);
+  b.slide.ticks = 0;
+  b.ratchets = 0;
+  b.gateSamples = 0;
+  publishVoice(trigger);
+}
+
+// Play a step as the sequencer does. A rest, or a step that loses its roll, ends 
+// the note playing; a tie carries it on with this step's sound. Held is set when 
+// the next step is a tie, so nothing releases the note before it gets there.
+void sequenceStep(const Step &s, bool held){
+  if(s.rest || (s.skip && (xorshift() & 15) < s.skip)){
+    publishRelease();
+    return;
+  }
+  VoiceBlock &b = voiceBack();
+  uint16_t from_sync = sent_sync;
+  uint16_t from_grain = sent_grain;
+  stepParams(b.params, s);
+  stepFilter(b.filter, s);
+  b.slide.ticks = 0;
+  if(s.slide){
+    // 16ths of the step in control ticks, at least two so the increments fit 16 bits
+    uint16_t ticks = ((uint32_t)hit_samples[0] * s.slide) / (16 * GRAIN_CONTROL_RATE);
+    ticks = constrain(ticks, 2, 255);
+    b.slide.ticks = ticks;
+    b.slide.syncStep = ((int32_t)b.params.syncPhaseInc - from_sync) / (int16_t)ticks;
+    b.slide.grainStep = ((int32_t)b.params.grainPhaseInc - from_grain) / (int16_t)ticks;
+  }
+  b.ratchets = s.tie ? 0 : s.ratchet;
+  b.hitSamples = hit_samples[b.ratchets];
+  b.gateSamples = (held || !s.length) ? 0 : ((uint32_t)b.hitSamples * s.length) >> 4;
+  publishVoice(!s.tie);
+}
+
+// One of the five step parameters from a pot reading (0-1023), in the order 
+// of editControls[]. MIDI CCs come in through here as well.
+void setStepParam(Step &s, uint8_t param, uint16_t value){
+  switch(param){
+    case 0: s.syncPhaseInc   = quantize(value); break;
+    case 1: s.grainPhaseInc  = mapPhaseInc(value) / 2; break;
+    case 2: s.grainDecay     = value / 8; break;
+    case 3: s.grain2PhaseInc = mapPhaseInc(value) / 2; break;
+    case 4: s.grain2Decay    = value / 4; break;
+  }
+}
+
+// How the step plays from a pot reading, on the same pots: chance (all the way 
+// down is a rest), ratchets 1-4, length 1-16 16ths, slide 0-15 16ths and tie.
+void setStepPlay(Step &s, uint8_t param, uint16_t value){
+  switch(param){
+    case 0: {
+      uint8_t chance = ((uint32_t)value * 17) >> 10;
+      s.rest = (chance == 0);
+      s.skip = chance ? 16 - chance : 0;
+      break;
+    }
+    case 1: s.ratchet = value >> 8; break;
+    case 2: s.length  = ((value >> 6) + 1) & 15; break;
+    case 3: s.slide   = value >> 6; break;
+    case 4: s.tie     = value >= 512; break;
+  }
+}
+
+// The wavetable of a grain from its frequency pot, parameter 1 or 3 as in setStepParam()
+void setStepWave(Step &s, uint8_t param, uint16_t value){
+  uint8_t wave = ((uint32_t)value * WAVES) >> 10;
+  if(param == 1){s.grainWave = wave;}
+  else if(param == 3){s.grain2Wave = wave;}
+}
+
+// The bus filter (bus_filter.h) from a pot reading: mode (off, low, band or high 
+// pass), cutoff and resonance. The editor has them on pots 0, 2 and 4.
+void setStepFilter(Step &s, uint8_t param, uint16_t value){
+  switch(param){
+    case 0: s.filter    = value >> 8; break;
+    case 1: s.cutoff    = value >> 4; break;
+    case 2: s.resonance = value >> 6; break;
+  }
+}
+
+const byte editControls[5] = {SYNC_CONTROL,GRAIN_FREQ_CONTROL,GRAIN_DECAY_CONTROL,GRAIN2_FREQ_CONTROL,GRAIN2_DECAY_CONTROL};
+
+static const char waveName0[] PROGMEM = "tri";
+static const char waveName1[] PROGMEM = "sine";
+static const char waveName2[] PROGMEM = "saw";
+static const char waveName3[] PROGMEM = "square";
+static const char waveName4[] PROGMEM = "pulse";
+static const char waveName5[] PROGMEM = "formA";
+static const char waveName6[] PROGMEM = "formB";
+static const char waveName7[] PROGMEM = "user";
+static const char *const waveNames[WAVES] PROGMEM = {
+  waveName0, waveName1, waveName2, waveName3, waveName4, waveName5, waveName6, waveName7
+};
+
+const __FlashStringHelper *waveName(uint8_t wave){
+  return (const __FlashStringHelper *)pgm_read_word(&waveNames[wave & (WAVES - 1)]);
+}
+
+// e.g. "1 square 2 formA"
+void showStepWave(const Step &s){
+  lcd.clear();
+  lcd.print(F("1 ")); lcd.print(waveName(s.grainWave));
+  lcd.print(F(" 2 ")); lcd.print(waveName(s.grain2Wave));
+}
+
+// e.g. "BP C42 R15": mode, cutoff and resonance
+void showStepFilter(const Step &s){
+  lcd.clear();
+  if(s.filter == FILTER_OFF){
+    lcd.print(F("Filter off"));
+    return;
+  }
+  lcd.print(s.filter == FILTER_LOW ? F("LP") : s.filter == FILTER_BAND ? F("BP") : F("HP"));
+  lcd.print(F(" C")); lcd.print(s.cutoff);
+  lcd.print(F(" R")); lcd.print(s.resonance);
+}
+
+// e.g. "P12 R4 L16 S3 T": chance in 16ths, hits, length, slide and tie
+void showStepPlay(const Step &s){
+  lcd.clear();
+  lcd.print('P'); lcd.print(s.rest ? 0 : 16 - s.skip);
+  lcd.print(F(" R")); lcd.print(s.ratchet + 1);
+  lcd.print(F(" L")); lcd.print(s.length ? s.length : 16);
+  lcd.print(F(" S")); lcd.print(s.slide);
+  if(s.tie){lcd.print(F(" T"));}
+}
+
+void readEditPots(){
+  Step before = editBuffer;
+  for(byte i = 0; i < 5; i++){
+    int pot = adcRead(editControls[i]);
+    if(!(edit_moved & (1 << i))){
+      if(pot <= edit_pots[i] + EDIT_PICKUP && pot >= edit_pots[i] - EDIT_PICKUP){continue;}
+      edit_moved |= 1 << i;
+    }
+    if(edit_page == EDIT_PLAY){setStepPlay(editBuffer, i, pot);}
+    else if(edit_page == EDIT_WAVE){
+      if(i & 1){setStepWave(editBuffer, i, pot);}
+      else{setStepFilter(editBuffer, i >> 1, pot);}
+    }
+    else{setStepParam(editBuffer, i, pot);}
+  }
+  if(memcmp(&before, &editBuffer, sizeof(Step))){
+    if(edit_page == EDIT_PLAY){showStepPlay(editBuffer);}
+    else if(edit_page == EDIT_WAVE){
+      // Whichever half of the page was turned
+      if(before.grainWave != editBuffer.grainWave || before.grain2Wave != editBuffer.grain2Wave){showStepWave(editBuffer);}
+      else{showStepFilter(editBuffer);}
+    }
+  }
+  last_edit_scan = millis();
+}
 
 void changeStep(int step_num){
+  if(edit_step == step_num){return;}
+  edit_step = step_num;
+  editBuffer = steps[step_num-1];
+  // The pots set the sound of the step straight away, as they always have
+  edit_page = EDIT_SOUND;
+  edit_moved = 0x1F;
+  readEditPots();
+}
 
-/* The first thing we do is to turn off all indicator lights so that we can properly indicate 
-which step we're currently editing. */  
-  
-  digitalWrite(39, LOW);digitalWrite(41, LOW);digitalWrite(43, LOW);digitalWrite(45, LOW);
-  digitalWrite(47, LOW);digitalWrite(49, LOW);digitalWrite(51, LOW);digitalWrite(53, LOW);
-  digitalWrite(38, LOW);digitalWrite(40, LOW);digitalWrite(42, LOW);digitalWrite(44, LOW);
-  digitalWrite(46, LOW);digitalWrite(48, LOW);digitalWrite(50, LOW);digitalWrite(52, LOW); 
+// LED frame: the playhead, plus the step open in the editor blinking at about 4Hz
+void updateLeds(){
+  uint16_t frame = pattern ? STEP_BIT(pattern) : 0;
+  if(edit_step){
+    frame &= ~STEP_BIT(edit_step);
+    if(millis() & 0x80){frame |= STEP_BIT(edit_step);}
+  }
+  ledShow(frame);
+}
 
-// Then indicate the appropriate step.  
+void editStep(){
+  if(edit_step == 0){return;}
 
-    switch(step_num){
-    
-    case 1:
-    digitalWrite(53, HIGH); break;
-    case 2:
-    digitalWrite(51, HIGH); break;
-    case 3:
-    digitalWrite(49, HIGH); break;
-    case 4:
-    digitalWrite(47, HIGH); break;
-    case 5:
-    digitalWrite(45, HIGH); break;
-    case 6:
-    digitalWrite(43, HIGH); break;
-    case 7:
-    digitalWrite(41, HIGH); break; 
-    case 8:
-    digitalWrite(39, HIGH); break;
-    case 9:
-    digitalWrite(52, HIGH); break;
-    case 10:
-    digitalWrite(50, HIGH); break;
-    case 11:
-    digitalWrite(48, HIGH); break;
-    case 12:
-    digitalWrite(46, HIGH); break;
-    case 13:
-    digitalWrite(44, HIGH); break;
-    case 14:
-    digitalWrite(42, HIGH); break;
-    case 15:
-    digitalWrite(40, HIGH); break; 
-    case 16:
-    digitalWrite(38, HIGH); break;
-  }
-
-/* This next chunk of code is fairly similar to the unaltered Auduino sketch. This allows 
-us to continue updating the synth parameters to the user input. That way, you can dial in 
-the sound of a particular step. The while-loop traps the program flow here until the user 
-pushes button 1. As the code currently stands, "live" parameters aren't applied while in 
-the step editor but you could easily add the live parameters below. */
-
-while(1){  
-  // lcd.clear(); 
-  // lcd.print(step_num);
-  // counter++;
-  // if(counter>tempo){
-  
-  counter=0;
-  syncPhaseInc = mapPentatonic(analogRead(SYNC_CONTROL));
-  grainPhaseInc  = mapPhaseInc(analogRead(GRAIN_FREQ_CONTROL)) / 2;
-  grainDecay     = analogRead(GRAIN_DECAY_CONTROL) / 8;
-  grain2PhaseInc = mapPhaseInc(analogRead(GRAIN2_FREQ_CONTROL)) / 2;
-  grain2Decay    = analogRead(GRAIN2_DECAY_CONTROL) / 4; 
+  uint8_t page = pressed[1] ? EDIT_PLAY : pressed[2] ? EDIT_WAVE : EDIT_SOUND;
+  if(page != edit_page){
+    edit_page = page;
+    for(byte i = 0; i < 5; i++){edit_pots[i] = adcRead(editControls[i]);}
+    edit_moved = 0;
+    if(page == EDIT_PLAY){showStepPlay(editBuffer);}
+    else if(page == EDIT_WAVE){showStepWave(editBuffer);}
+  }
+
+  if(millis() - last_edit_scan >= EDIT_SCAN_MS){
+    readEditPots();
+    // Let the changes be heard right away if the step is sounding
+    if(pattern == edit_step){playStep(editBuffer, false);}
+  }
 
 //Here we read the button 1 input and commit the step changes to the appropriate parameters.
-  
-  if(digitalRead(37)==LOW && step_num==1){
-  a1 = syncPhaseInc; a2 = grainPhaseInc; a3 = grainDecay; a4 = grain2PhaseInc; a5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==2){
-  b1 = syncPhaseInc; b2 = grainPhaseInc; b3 = grainDecay; b4 = grain2PhaseInc; b5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==3){
-  c1 = syncPhaseInc; c2 = grainPhaseInc; c3 = grainDecay; c4 = grain2PhaseInc; c5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==4){
-  d1 = syncPhaseInc; d2 = grainPhaseInc; d3 = grainDecay; d4 = grain2PhaseInc; d5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==5){
-  e1 = syncPhaseInc; e2 = grainPhaseInc; e3 = grainDecay; e4 = grain2PhaseInc; e5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==6){
-  f1 = syncPhaseInc; f2 = grainPhaseInc; f3 = grainDecay; f4 = grain2PhaseInc; f5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==7){
-  g1 = syncPhaseInc; g2 = grainPhaseInc; g3 = grainDecay; g4 = grain2PhaseInc; g5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==8){
-  h1 = syncPhaseInc; h2 = grainPhaseInc; h3 = grainDecay; h4 = grain2PhaseInc; h5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==9){
-  i1 = syncPhaseInc; i2 = grainPhaseInc; i3 = grainDecay; i4 = grain2PhaseInc; i5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==10){
-  j1 = syncPhaseInc; j2 = grainPhaseInc; j3 = grainDecay; j4 = grain2PhaseInc; j5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==11){
-  k1 = syncPhaseInc; k2 = grainPhaseInc; k3 = grainDecay; k4 = grain2PhaseInc; k5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==12){
-  l1 = syncPhaseInc; l2 = grainPhaseInc; l3 = grainDecay; l4 = grain2PhaseInc; l5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==13){
-  m1 = syncPhaseInc; m2 = grainPhaseInc; m3 = grainDecay; m4 = grain2PhaseInc; m5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==14){
-  n1 = syncPhaseInc; n2 = grainPhaseInc; n3 = grainDecay; n4 = grain2PhaseInc; n5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==15){
-  o1 = syncPhaseInc; o2 = grainPhaseInc; o3 = grainDecay; o4 = grain2PhaseInc; o5 = grain2Decay; return;}
-  else if(digitalRead(37)==LOW && step_num==16){
-  p1 = syncPhaseInc; p2 = grainPhaseInc; p3 = grainDecay; p4 = grain2PhaseInc; p5 = grain2Decay; return;}
-
-}}
+  if(justpressed[0]){
+    steps[edit_step-1] = editBuffer;
+    markDirty(edit_step-1);
+    edit_step = 0;
+  }
+}
+
+/* Scale. Holding button 37 turns pot 15 into the scale knob: 60 positions, each of 
+the five scales (quantizer.h) over the twelve roots, shown on the LCD. Like the delay 
+knob it only takes over once it has been turned, so a press on 37 still just commits 
+an edit. The scale applies to the steps dialled in from then on. */
+#define SCALE_PICKUP 16
+
+int scale_pot;
+bool scale_pickup = false;
+uint8_t scale_num = SCALE_DEFAULT;
+uint8_t scale_root = SCALE_ROOT;
+
+void selectScale(uint8_t scale, uint8_t root){
+  scale_num = scale;
+  scale_root = root;
+  setScale(scale, root);
+  lcd.clear();
+  printRoot(lcd, root);
+  lcd.print(' ');
+  lcd.print(scaleName(scale));
+}
+
+void scaleControls(){
+  if(justpressed[0]){
+    scale_pot = adcRead(15);
+    scale_pickup = false;
+  }
+  if(pressed[0] && !pressed[1] && !pressed[2]){
+    int pot = adcRead(15);
+    if(pot > scale_pot + SCALE_PICKUP || pot < scale_pot - SCALE_PICKUP){scale_pickup = true;}
+    if(scale_pickup){
+      uint8_t pos = ((uint32_t)pot * SCALES * 12) >> 10;
+      if(pos != scale_num * 12 + scale_root){selectScale(pos / 12, pos % 12);}
+    }
+  }
+}
+
+/* MIDI control, on any channel unless MIDI_CHANNEL (1-16) is set:
+  - note-on transposes the sequence (see transposeInc())
+  - CC 19 picks the step (0-15) that CCs 20-24 set the five parameters of, in the 
+    order of the edit pots: sync, grain 1 frequency and decay, grain 2 frequency 
+    and decay, and CCs 27-31 how it plays, in the order of the play page of the 
+    editor: chance, ratchets, length, slide and tie
+  - CCs 102 and 103 pick the wavetable (0-7, wavetables.h) of its grain 1 and grain 2, 
+    and CCs 104-106 set its filter mode, cutoff and resonance in the order of the 
+    filter pots of the editor
+  - CC 107 picks a song entry (0-31) that CCs 108-111 set the pattern (0-7), bars 
+    (1-32), tempo and steps of, the last two 0 for those of the pattern, and CC 112 
+    sets the number of entries in the song (0-32)
+  - CC 25 picks the scale (0-4) and CC 26 the root (0-11, C to B)
+  - SysEx F0 7D 01 F7 asks for a dump of the playing pattern, which comes back as 
+    F0 7D 02 <number> <pattern> F7, the pattern 7 bit packed (see midi.h). Sending 
+    that back loads it into the playing pattern, the number is ignored.
+  - SysEx F0 7D 05 F7 asks for a dump of the song, F0 7D 06 <song> F7, which loads 
+    it when sent back
+  - SysEx F0 7D 03 F7 asks for the RAM figures (memstats.h), which come back as 
+    F0 7D 04 <static RAM> <stack never used> F7, two 16 bit little endian numbers 
+    packed the same way */
+#ifndef MIDI_CHANNEL
+#define MIDI_CHANNEL 0
+#endif
+#define MIDI_CC_STEP        19
+#define MIDI_CC_PARAM       20
+#define MIDI_CC_SCALE       25
+#define MIDI_CC_ROOT        26
+#define MIDI_CC_PLAY        27
+#define MIDI_CC_WAVE        102
+#define MIDI_CC_WAVE2       103
+#define MIDI_CC_FILTER      104
+#define MIDI_CC_SONG        107
+#define MIDI_CC_SONG_LENGTH 112
+#define SYSEX_ID            0x7D    // non-commercial
+#define SYSEX_DUMP_REQUEST  0x01
+#define SYSEX_DUMP          0x02
+#define SYSEX_MEMORY_REQUEST 0x03
+#define SYSEX_MEMORY        0x04
+#define SYSEX_SONG_REQUEST  0x05
+#define SYSEX_SONG          0x06
+
+uint8_t midi_step = 0;
+uint8_t midi_song_entry = 0;
+uint8_t sysex_header[3] = {SYSEX_ID, SYSEX_DUMP, 0};
+uint16_t memory_report[2];
+
+// Pattern, bars, tempo or steps of the song entry picked over MIDI, from a CC value
+void setSongEntry(uint8_t param, uint8_t value){
+  SongEntry &e = song.entry[midi_song_entry];
+  switch(param){
+    case 0: e.pattern = value & 7; break;
+    case 1: e.repeats = value ? min(value, 32) - 1 : 0; break;
+    case 2: e.tempo   = value ? min(value + TEMPO_MIN - 1, TEMPO_MAX) : 0; break;
+    case 3: e.length  = min(value, NUMSTEPS); break;
+  }
+  markSongDirty(midi_song_entry / SONG_PART_ENTRIES);
+}
+
+void midiSysexMessage(){
+  uint8_t length;
+  const uint8_t *sysex = midiSysex(&length);
+  if(length < 2 || sysex[0] != SYSEX_ID){return;}
+
+  if(sysex[1] == SYSEX_DUMP_REQUEST && !midiSending()){
+    sysex_header[1] = SYSEX_DUMP;
+    sysex_header[2] = pattern_num;
+    midiSendSysex(sysex_header, sizeof(sysex_header), (const uint8_t *)playing, sizeof(Pattern));
+  }
+  else if(sysex[1] == SYSEX_MEMORY_REQUEST && !midiSending()){
+    sysex_header[1] = SYSEX_MEMORY;
+    memory_report[0] = staticRam();
+    memory_report[1] = stackUnused();
+    midiSendSysex(sysex_header, 2, (const uint8_t *)memory_report, sizeof(memory_report));
+  }
+  else if(sysex[1] == SYSEX_SONG_REQUEST && !midiSending()){
+    sysex_header[1] = SYSEX_SONG;
+    midiSendSysex(sysex_header, 2, (const uint8_t *)&song, sizeof(Song));
+  }
+  else if(sysex[1] == SYSEX_SONG && length > 2){
+    Song s;
+    if(midiUnpack(sysex + 2, length - 2, (uint8_t *)&s, sizeof(s)) != sizeof(s)){return;}
+    if(midiSending()){return;}    // a song dump going out reads the song
+    s.count = min(s.count, SONG_ENTRIES);
+    for(uint8_t i = 0; i < SONG_ENTRIES; i++){songEntryCheck(s.entry[i]);}
+    song = s;
+    if(!song.count){songStop();}
+    for(uint8_t i = 0; i < SONG_PARTS; i++){markSongDirty(i);}
+    lcd.clear();
+    lcd.print(F("Song loaded"));
+  }
+  else if(sysex[1] == SYSEX_DUMP && length > 3){
+    Pattern p;
+    if(midiUnpack(sysex + 3, length - 3, (uint8_t *)&p, sizeof(p)) != sizeof(p)){return;}
+    if(midiSending()){return;}    // the dump going out reads the playing pattern
+    p.length = constrain(p.length, 1, NUMSTEPS);
+    p.tempo = constrain(p.tempo, TEMPO_MIN, TEMPO_MAX);
+    *playing = p;
+    // A step open in the editor would be written back over the new one, drop it
+    edit_step = 0;
+    current_steps = previous_steps = p.length;
+    current_tempo = previous_tempo = p.tempo;
+    setTempo(current_tempo);
+    for(uint8_t i = 0; i <= BANK_SETTINGS; i++){markDirty(i);}
+    lcd.clear();
+    lcd.print(F("Pattern loaded"));
+  }
+}
+
+void midiService(){
+  MidiMessage m;
+  while(midiRead(m)){
+    if(m.status == MIDI_SYSEX){
+      midiSysexMessage();
+      continue;
+    }
+    if(MIDI_CHANNEL && (m.status & 0x0F) != MIDI_CHANNEL - 1){continue;}
+    switch(m.status & 0xF0){
+      case 0x90:
+        if(m.data2){transpose = constrain((int)m.data1 - MIDI_TRANSPOSE_ROOT, -24, 24);}
+        break;
+      case 0xB0:
+        if(m.data1 == MIDI_CC_STEP){midi_step = m.data2 & (NUMSTEPS - 1);}
+        else if(m.data1 >= MIDI_CC_PARAM && m.data1 < MIDI_CC_PARAM + 5){
+          // 0-127 onto the pot range
+          setStepParam(steps[midi_step], m.data1 - MIDI_CC_PARAM, (m.data2 << 3) | (m.data2 >> 4));
+          markDirty(midi_step);
+        }
+        else if(m.data1 >= MIDI_CC_PLAY && m.data1 < MIDI_CC_PLAY + 5){
+          setStepPlay(steps[midi_step], m.data1 - MIDI_CC_PLAY, (m.data2 << 3) | (m.data2 >> 4));
+          markDirty(midi_step);
+        }
+        else if((m.data1 == MIDI_CC_WAVE || m.data1 == MIDI_CC_WAVE2) && m.data2 < WAVES){
+          if(m.data1 == MIDI_CC_WAVE){steps[midi_step].grainWave = m.data2;}
+          else{steps[midi_step].grain2Wave = m.data2;}
+          markDirty(midi_step);
+        }
+        else if(m.data1 >= MIDI_CC_FILTER && m.data1 < MIDI_CC_FILTER + 3){
+          setStepFilter(steps[midi_step], m.data1 - MIDI_CC_FILTER, (m.data2 << 3) | (m.data2 >> 4));
+          markDirty(midi_step);
+        }
+        else if(m.data1 == MIDI_CC_SONG){midi_song_entry = m.data2 & (SONG_ENTRIES - 1);}
+        else if(m.data1 > MIDI_CC_SONG && m.data1 < MIDI_CC_SONG_LENGTH){setSongEntry(m.data1 - MIDI_CC_SONG - 1, m.data2);}
+        else if(m.data1 == MIDI_CC_SONG_LENGTH && m.data2 <= SONG_ENTRIES){
+          song.count = m.data2;
+          if(!song.count){songStop();}
+          markSongDirty(0);
+        }
+        else if(m.data1 == MIDI_CC_SCALE && m.data2 < SCALES){selectScale(m.data2, scale_root);}
+        else if(m.data1 == MIDI_CC_ROOT && m.data2 < 12){selectScale(scale_num, m.data2);}
+        break;
+    }
+  }
+  midiTask();
+}
+
+/* Telemetry (telemetry.h, -D TELEMETRY builds only). Holding buttons 37 and 33 shows 
+it on both rows of the LCD, refreshed every TELEMETRY_SHOW_MS, and letting go starts the 
+worst case figures and counters over. Pot 15 leaves the delay alone meanwhile. */
+#ifdef TELEMETRY
+#define TELEMETRY_SHOW_MS 250
+
+bool telemetry_shown = false;
+unsigned long telemetry_drawn = 0;
+
+// 37 and 33 held, and 35 not
+bool telemetryHeld(){
+  return pressed[0] && pressed[2] && !pressed[1];
+}
+
+void telemetryPage(){
+  bool show = telemetryHeld();
+  if(show){
+    if(!telemetry_shown || millis() - telemetry_drawn >= TELEMETRY_SHOW_MS){
+      telemetry_drawn = millis();
+      lcd.clear();
+      telemetryShow(lcd, 0);
+      lcd.setCursor(0, 1);
+      telemetryShow(lcd, 1);
+    }
+  }
+  else if(telemetry_shown){
+    telemetryReset();
+    lcd.clear();
+  }
+  telemetry_shown = show;
+}
+#else
+const bool telemetry_shown = false;
+inline bool telemetryHeld(){return false;}
+inline void telemetryPage(){}
+#endif
+
+/* Delay controls. Holding button 33 turns pot 15 into the delay knob for the setting on 
+the LCD, and a tap on 33 moves on to the next one: time, feedback, mix. The pot only takes 
+over once it has been turned, so paging through the settings leaves them alone. 
+The time is counted in half steps and follows the tempo, internal or external. A mix of 0 
+switches the delay off; holding both of the first two shift buttons still throws it in at 
+half mix, as the old echo did. */
+#define DELAY_TIME      0
+#define DELAY_FEEDBACK  1
+#define DELAY_MIX       2
+#define DELAY_PICKUP    16      // pot travel before it takes over
+
+uint8_t delay_param = DELAY_TIME;
+int delay_pot;
+bool delay_pickup = false;
+bool delay_tap = false;         // 33 is down and has done nothing else yet
+uint8_t delay_halfsteps = 2;
+uint8_t delay_feedback = 128;
+uint8_t delay_mix = 0;
+uint32_t delay_samples = 0;
+
+void showDelay(){
+  lcd.clear();
+  if(delay_param == DELAY_TIME){lcd.print(F("Delay time "));}
+  else if(delay_param == DELAY_FEEDBACK){lcd.print(F("Feedback "));}
+  else{lcd.print(F("Mix "));}
+  if(delay_param == DELAY_TIME){lcd.print(delay_halfsteps); lcd.print(F("/2"));}
+  else{lcd.print(delay_param == DELAY_FEEDBACK ? delay_feedback : delay_mix);}
+}
+
+void delayControls(){
+  if(justpressed[2] && !pressed[1]){
+    delay_pot = adcRead(15);
+    delay_pickup = false;
+    delay_tap = true;
+    // The step editor shows its wave page meanwhile, the delay turns up once its pot moves
+    if(!edit_step){showDelay();}
+  }
+  // The telemetry page holds 33 too, that is no tap
+  if(telemetryHeld()){delay_tap = false;}
+  if(justreleased[2] && delay_tap){
+    delay_param = (delay_param == DELAY_MIX) ? DELAY_TIME : delay_param + 1;
+    delay_tap = false;
+    showDelay();
+  }
+  if(pressed[2] && !pressed[1] && !telemetryHeld()){
+    int pot = adcRead(15);
+    if(pot > delay_pot + DELAY_PICKUP || pot < delay_pot - DELAY_PICKUP){
+      delay_pickup = true;
+      delay_tap = false;
+    }
+    if(delay_pickup){
+      uint8_t *value = (delay_param == DELAY_TIME) ? &delay_halfsteps :
+                       (delay_param == DELAY_FEEDBACK) ? &delay_feedback : &delay_mix;
+      uint8_t v = (delay_param == DELAY_TIME) ? map(pot,0,1023,1,8) :
+                  (delay_param == DELAY_FEEDBACK) ? map(pot,0,1023,0,240) : pot >> 2;
+      if(v != *value){
+        *value = v;
+        showDelay();
+      }
+    }
+  }
+
+  // Both are single bytes, the audio interrupt picks them up as they are
+  echo.feedback = delay_feedback;
+  echo.mix = (pressed[0] && pressed[1] && delay_mix < 128) ? 128 : delay_mix;
+
+  // Follow the tempo
+  uint32_t samples = (uint32_t)currentStepSamples() * delay_halfsteps / 2;
+  if(samples != delay_samples){
+    delay_samples = samples;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+      echo.setTime(samples);
+    }
+  }
+}
+
+/* Status line. The bottom row of the LCD keeps showing the pattern (and the one queued 
+after it), the step playing, the tempo and whether the delay is on, e.g. "P1>2 03/16 120 D". 
+Messages print on the top row. It is redrawn every STATUS_MS, which only costs the cells 
+that changed going out to the display (lcd.h). */
+#define STATUS_MS 20
+
+unsigned long status_drawn = 0;
+
+void printPadded(int value, uint8_t width, char pad){
+  for(int limit = 10; width > 1; width--, limit *= 10){
+    if(value < limit){lcd.print(pad);}
+  }
+  lcd.print(value);
+}
+
+void showStatus(){
+  if(telemetry_shown || millis() - status_drawn < STATUS_MS){return;}
+  status_drawn = millis();
+  lcd.setCursor(0, 1);
+  lcd.print(song_on ? 'S' : 'P');
+  lcd.print(pattern_num + 1);
+  if(pattern_next >= 0){lcd.print('>'); lcd.print(pattern_next + 1);}
+  else{lcd.print(F("  "));}
+  lcd.print(' ');
+  printPadded(pattern, 2, '0');
+  lcd.print('/');
+  printPadded(current_steps, 2, '0');
+  lcd.print(' ');
+  printPadded(extSync ? externalTempo() : current_tempo, 3, ' ');
+  lcd.print(echo.mix ? F(" D") : F("  "));
+}
 
 void loop() {
 
+  telemetryLoop();
   check_switches();
 
   //HOLD SECOND AND THIRD SHIFT FOR ADJUST NRS OF STEPS
   if(pressed[1] && pressed[2]){
-    current_steps = map(analogRead(15),0,1023,1,17);
+    current_steps = constrain(map(adcRead(15),0,1023,1,17),1,NUMSTEPS);
     if(previous_steps != current_steps){
       lcd.clear(); 
       lcd.print(current_steps);
       pattern = 0;
+      playing->length = current_steps;
+      markDirty(BANK_SETTINGS);
     }
     previous_steps = current_steps;
     
@@ -401,265 +1244,200 @@ void loop() {
 
   //HOLD SECOND SHIFT FOR ADJUST TEMPO
   if(pressed[1] && !pressed[2]){
-    current_tempo = map(analogRead(15),0,1023,60,180);
+    current_tempo = map(adcRead(15),0,1023,TEMPO_MIN,TEMPO_MAX);
     
     if(previous_tempo != current_tempo){
+      setTempo(current_tempo);
       lcd.clear(); 
       lcd.print(current_tempo);
+      playing->tempo = current_tempo;
+      markDirty(BANK_SETTINGS);
     }
     previous_tempo = current_tempo;
   }
   
-  ms_clock = ((60000/current_tempo)/4); // 1/16 steps
-  unsigned long current_tmpstmp = millis();
-
+  // Switch 27 up runs the internal clock, down follows the sync input or MIDI clock
+  bool external = inputDown(IN_PIN27);
+  if(external != extSync){setClockSource(external);}
 
-  if(digitalRead(27)==HIGH){
-    if(current_tmpstmp - prev_tmstmp > ms_clock){
-      prev_tmstmp = current_tmpstmp;
-      int_clock = true;
-    }
-    else{
-      int_clock = false;
+  if(external){
+    int tempo = externalTempo();
+    if(tempo > previous_ext_tempo + 1 || tempo < previous_ext_tempo - 1){
+      lcd.clear(); 
+      lcd.print(tempo);
+      previous_ext_tempo = tempo;
     }
-    chosen_clock = int_clock;  
-  }
-  // else{
-  //   if(digitalRead(11)==1){
-  //     ext_clock = true;
-  //     unsigned long diff_tmpstmp = current_tmpstmp - prev_tmstmp;
-  //     prev_tmstmp = current_tmpstmp;
-  //     tempo = (60000/diff_tmpstmp)/2;
-  //     lcd.clear(); 
-  //     lcd.print(tempo);
-  //     }
-  //   else{
-  //     ext_clock = false;
-  //   }
-  //   chosen_clock = ext_clock;
-  // }
-  
-  counter++;
+  }
+
+  // A MIDI start restarts the pattern from step 1
+  if(clockRestart){
+    clockRestart = false;
+    pattern = 0;
+  }
 
-/* Most of the time, the main loop will just advance the counter while we continue generating noise. 
-Each iteration, we check the counter against our "tempo" parameter to find out if it's time yet to 
-jump to the next step. */  
+  // Steps raised by the clock since the last pass
+  bool step_due = (stepsTaken != stepsRaised);
+  if(step_due){
+    telemetryStepTaken(stepsRaised - stepsTaken);
+    stepsTaken++;
+  }
+
+/* Most of the time, the main loop just services the controls while we continue generating noise. 
+Each iteration, we check whether the clock has counted off another step yet. */  
   
-  if(chosen_clock){
-    delay(20);
-  //Tempo Control for int_clock
- 
-  //Delay for ext_clock
-  //delay(20);
+  if(step_due){
  
-//Housecleaning: Just a few things to get out of the way since the counter is "full"
-  counter=0;
-  if(pattern==current_steps){pattern=0;}
+//Housecleaning: Just a few things to get out of the way since the step is due
+  if(pattern>=current_steps){pattern=0;}
+  // Bar boundary, a queued pattern takes over from step 1
+  if(pattern==0){
+    if(song_on){songBar();}
+    else if(patternReady()){switchPattern();}
+  }
   pattern++;
-  digitalWrite(39, LOW);digitalWrite(41, LOW);digitalWrite(43, LOW);digitalWrite(45, LOW);
-  digitalWrite(47, LOW);digitalWrite(49, LOW);digitalWrite(51, LOW);digitalWrite(53, LOW);
-  digitalWrite(38, LOW);digitalWrite(40, LOW);digitalWrite(42, LOW);digitalWrite(44, LOW);
-  digitalWrite(46, LOW);digitalWrite(48, LOW);digitalWrite(50, LOW);digitalWrite(52, LOW);
-  
+  if(pattern==current_steps){songPrefetch();}
  
 //Live Tweaks: Read the analog inputs associated with each "live" parameter.
-  live_sync_phase = map(analogRead(14),0,1023,-500,500);
-  live_grain_phase = map(analogRead(10),0,1023,-200,200);
-  live_grain_decay = map(analogRead(9),0,1023,-20,20);
-  live_grain2_phase = map(analogRead(8),0,1023,-200,200);
-  live_grain2_decay = map(analogRead(11),0,1023,-50,50);
-  
-//Grab the parameters for the step that we're now in. We'll use a series of case
-//statements switched on the "pattern" variable that we incremented earlier.
-
-/* In each of the case routines below you'll notice that we're addressing 
-each of the existing Auduino parameters and making them equal to the stored 
-parameter plus the associated "live" parameter. */
-  if(digitalRead(31) == HIGH){
-    switch(pattern){
-      case 1:
-      syncPhaseInc = a1 + live_sync_phase; grainPhaseInc = a2 + live_grain_phase; 
-      grainDecay = a3 + live_grain_decay; grain2PhaseInc = a4 + live_grain2_phase;
-      grain2Decay = a5 + live_grain2_decay; 
-      digitalWrite(53, HIGH); break;
-      case 2:
-      syncPhaseInc = b1 + live_sync_phase; grainPhaseInc = b2 + live_grain_phase; 
-      grainDecay = b3 + live_grain_decay; grain2PhaseInc = b4 + live_grain2_phase; 
-      grain2Decay = b5 + live_grain2_decay; 
-      digitalWrite(51, HIGH); break;
-      case 3:
-      syncPhaseInc = c1 + live_sync_phase; grainPhaseInc = c2 + live_grain_phase; 
-      grainDecay = c3 + live_grain_decay; grain2PhaseInc = c4 + live_grain2_phase; 
-      grain2Decay = c5 + live_grain2_decay; 
-      digitalWrite(49, HIGH); break;
-      case 4:
-      syncPhaseInc = d1 + live_sync_phase; grainPhaseInc = d2 + live_grain_phase; 
-      grainDecay = d3 + live_grain_decay; grain2PhaseInc = d4 + live_grain2_phase; 
-      grain2Decay = d5 + live_grain2_decay; 
-      digitalWrite(47, HIGH); break;
-      case 5:
-      syncPhaseInc = e1 + live_sync_phase; grainPhaseInc = e2 + live_grain_phase; 
-      grainDecay = e3 + live_grain_decay; grain2PhaseInc = e4 + live_grain2_phase;
-      grain2Decay = e5 + live_grain2_decay; 
-      digitalWrite(45, HIGH); break;
-      case 6:
-      syncPhaseInc = f1 + live_sync_phase; grainPhaseInc = f2 + live_grain_phase; 
-      grainDecay = f3 + live_grain_decay; grain2PhaseInc = f4 + live_grain2_phase; 
-      grain2Decay = f5 + live_grain2_decay; 
-      digitalWrite(43, HIGH); break;
-      case 7:
-      syncPhaseInc = g1 + live_sync_phase; grainPhaseInc = g2 + live_grain_phase; 
-      grainDecay = g3 + live_grain_decay; grain2PhaseInc = g4 + live_grain2_phase;
-      grain2Decay = g5 + live_grain2_decay; 
-      digitalWrite(41, HIGH); break; 
-      case 8:
-      syncPhaseInc = h1 + live_sync_phase; grainPhaseInc = h2 + live_grain_phase; 
-      grainDecay = h3 + live_grain_decay; grain2PhaseInc = h4 + live_grain2_phase; 
-      grain2Decay = h5 + live_grain2_decay; 
-      digitalWrite(39, HIGH); break;
-    }
+//With switch 31 off the offsets stay at zero and the stored step plays as-is.
+  if(!inputDown(IN_PIN31)){
+    live_sync_phase = map(adcRead(14),0,1023,-500,500);
+    live_grain_phase = map(adcRead(10),0,1023,-200,200);
+    live_grain_decay = map(adcRead(9),0,1023,-20,20);
+    live_grain2_phase = map(adcRead(8),0,1023,-200,200);
+    live_grain2_decay = map(adcRead(11),0,1023,-50,50);
+#ifdef LIVE_CUTOFF
+    live_cutoff = map(adcRead(12),0,1023,-32,32);
+#endif
   }else{
-    switch(pattern){
-      case 1:
-      syncPhaseInc = a1; grainPhaseInc = a2; grainDecay = a3; grain2PhaseInc = a4; grain2Decay = a5; 
-      digitalWrite(53, HIGH); break;
-      case 2:
-      syncPhaseInc = b1; grainPhaseInc = b2; grainDecay = b3; grain2PhaseInc = b4; grain2Decay = b5; 
-      digitalWrite(51, HIGH); break;
-      case 3:
-      syncPhaseInc = c1; grainPhaseInc = c2; grainDecay = c3; grain2PhaseInc = c4; grain2Decay = c5;
-      digitalWrite(49, HIGH); break;
-      case 4:
-      syncPhaseInc = d1; grainPhaseInc = d2; grainDecay = d3; grain2PhaseInc = d4; grain2Decay = d5;
-      digitalWrite(47, HIGH); break;
-      case 5:
-      syncPhaseInc = e1; grainPhaseInc = e2; grainDecay = e3; grain2PhaseInc = e4; grain2Decay = e5;
-      digitalWrite(45, HIGH); break;
-      case 6:
-      syncPhaseInc = f1; grainPhaseInc = f2; grainDecay = f3; grain2PhaseInc = f4; grain2Decay = f5; 
-      digitalWrite(43, HIGH); break;
-      case 7:
-      syncPhaseInc = g1; grainPhaseInc = g2; grainDecay = g3; grain2PhaseInc = g4; grain2Decay = g5;
-      digitalWrite(41, HIGH); break; 
-      case 8:
-      syncPhaseInc = h1; grainPhaseInc = h2; grainDecay = h3; grain2PhaseInc = h4; grain2Decay = h5;
-      digitalWrite(39, HIGH); break;
-      case 9:
-      syncPhaseInc = i1; grainPhaseInc = i2; grainDecay = i3; grain2PhaseInc = i4; grain2Decay = i5; 
-      digitalWrite(52,HIGH); break;
-      case 10:
-      syncPhaseInc = j1; grainPhaseInc = j2; grainDecay = j3; grain2PhaseInc = j4; grain2Decay = j5; 
-      digitalWrite(50,HIGH); break;
-      case 11:
-      syncPhaseInc = k1; grainPhaseInc = k2; grainDecay = k3; grain2PhaseInc = k4; grain2Decay = k5;
-      digitalWrite(48,HIGH); break;
-      case 12:
-      syncPhaseInc = l1; grainPhaseInc = l2; grainDecay = l3; grain2PhaseInc = l4; grain2Decay = l5;
-      digitalWrite(46,HIGH); break;
-      case 13:
-      syncPhaseInc = m1; grainPhaseInc = m2; grainDecay = m3; grain2PhaseInc = m4; grain2Decay = m5;
-      digitalWrite(44,HIGH); break;
-      case 14:
-      syncPhaseInc = n1; grainPhaseInc = n2; grainDecay = n3; grain2PhaseInc = n4; grain2Decay = n5; 
-      digitalWrite(42,HIGH); break;
-      case 15:
-      syncPhaseInc = o1; grainPhaseInc = o2; grainDecay = o3; grain2PhaseInc = o4; grain2Decay = o5;
-      digitalWrite(40,HIGH); break; 
-      case 16:
-      syncPhaseInc = p1; grainPhaseInc = p2; grainDecay = p3; grain2PhaseInc = p4; grain2Decay = p5;
-      digitalWrite(38,HIGH); break;
-    }
+    live_sync_phase = 0; live_grain_phase = 0; live_grain_decay = 0;
+    live_grain2_phase = 0; live_grain2_decay = 0; live_cutoff = 0;
   }
+  
+/* Grab the parameters for the step that we're now in. Every step lives in the 
+steps[] table, so this is a single indexed load no matter which step is playing, 
+and each stored parameter gets its associated "live" offset added. A step that is 
+open in the editor plays what is being dialled in instead. */
+  updateHitSamples();
+  sequenceStep(stepAt(pattern), stepAt(pattern % current_steps + 1).tie);
+  }
+
 //Check to see if the user is trying to change the step parameters.
-//This series of statements simply check for a button press from each of
-//the step buttons and call a function to change the indicated step.    
-
-    if(digitalRead(29) == LOW){
-      if(digitalRead(30)==LOW){changeStep(1);}
-      if(digitalRead(32)==LOW){changeStep(2);}
-      if(digitalRead(34)==LOW){changeStep(3);}
-      if(digitalRead(36)==LOW){changeStep(4);}
-      if(digitalRead(22)==LOW){changeStep(5);}
-      if(digitalRead(24)==LOW){changeStep(6);}
-      if(digitalRead(26)==LOW){changeStep(7);}
-      if(digitalRead(28)==LOW){changeStep(8);}
+//The step buttons select the step to edit, switch 29 picks steps 1-8 or 9-16.
+//Holding button 33 they pick the pattern instead, buttons 1-8 for patterns 1-8,
+//and on steps 9-16 start the song from entry 1-8.
+  if(step_pressed){
+    if(pressed[2]){
+      if(step_pressed > 8){songStart(step_pressed - 9);}
+      else{selectPattern(step_pressed - 1);}
+      delay_tap = false;
     }
-    else if(digitalRead(29) == HIGH){
-      if(digitalRead(30)==LOW){changeStep(9);}
-      if(digitalRead(32)==LOW){changeStep(10);}
-      if(digitalRead(34)==LOW){changeStep(11);}
-      if(digitalRead(36)==LOW){changeStep(12);}
-      if(digitalRead(22)==LOW){changeStep(13);}
-      if(digitalRead(24)==LOW){changeStep(14);}
-      if(digitalRead(26)==LOW){changeStep(15);}
-      if(digitalRead(28)==LOW){changeStep(16);}
-    }
-
-    
-
+    else{changeStep(step_pressed);}
+  }
 
-}}
+  editStep();
+  delayControls();
+  scaleControls();
+  midiService();
+  bankService();
+  updateLeds();
+  telemetryPage();
+  showStatus();
+}
 
-SIGNAL(PWM_INTERRUPT)
+// Compute the next output sample
+static inline uint8_t renderSample()
 {
-  uint8_t value;
-  uint16_t output;
-
-  syncPhaseAcc += syncPhaseInc;
-  if (syncPhaseAcc < syncPhaseInc) {
-    // Time to start the next grain
-    grainPhaseAcc = 0;
-    grainAmp = 0x7fff;
-    grain2PhaseAcc = 0;
-    grain2Amp = 0x7fff;
-    LED_PORT ^= 1 << LED_BIT; // Faster than using digitalWrite
+  uint8_t output;
+
+  for (uint8_t i = 0; i < GRAIN_VOICES; i++) {
+    GrainVoice &v = synth.voice[i];
+    bool wrapped = grainSync(v);
+    // Time to start the next grain, pick up new parameters if loop() sent any.
+    // A stopped sync oscillator never reaches a grain boundary, so latch right away.
+    // A trigger for a silent voice goes in at once and restarts it.
+    if (voicePending && voiceBlocks[voiceFront].voice == i) {
+      if (wrapped || v.syncPhaseInc == 0) latchVoice();
+      else if (voiceBlocks[voiceFront].trigger && synth.silent(i)) {
+        latchVoice();
+        synth.retrigger(i);
+      }
+    }
+    if (wrapped && i == synth.active) {
+      LED_PORT ^= 1 << LED_BIT; // Faster than using digitalWrite
+    }
   }
   
-  // Increment the phase of the grain oscillators
-  grainPhaseAcc += grainPhaseInc;
-  grain2PhaseAcc += grain2PhaseInc;
-
-  // Convert phase into a triangle wave
-  value = (grainPhaseAcc >> 7) & 0xff;
-  if (grainPhaseAcc & 0x8000) value = ~value;
-  // Multiply by current grain amplitude to get sample
-  output = value * (grainAmp >> 8);
-
-  // Repeat for second grain
-  value = (grain2PhaseAcc >> 7) & 0xff;
-  if (grain2PhaseAcc & 0x8000) value = ~value;
-  output += value * (grain2Amp >> 8);
-
-  // Make the grain amplitudes decay by a factor every sample (exponential decay)
-  grainAmp -= (grainAmp >> 8) * grainDecay;
-  grain2Amp -= (grain2Amp >> 8) * grain2Decay;
-
-  // Scale output to the available range, clipping if necessary
-  output >>= 9;
-  if (output > 255) output = 255;
-
-  if(pressed[0] && pressed[1]){
-    // MAX_DELAY = map(analogRead(14),0,1023,512,500);
-    // Output to PWM (this is faster than using analogWrite) 
-    // Here we add the delay buffer to the output value, this produces
-    // an subtle echo effect, the delay buffer is effectivley replaying the sound from
-    // 1/8th of a second ago.
+  // Count down to the next sequencer step, and the hits within this one
+#ifdef TELEMETRY
+  uint8_t raised = stepsRaised;
+  clockTick();
+  if (raised != stepsRaised) telemetryStep();
+#else
+  clockTick();
+#endif
+  hitTick();
+
+  output = busFilter.process(synth.mix());
+
+  if(echo.mix){
+    // Here we add the delay line to the output value, replaying the sound
+    // from one or more delay taps ago (see grain_delay.h and delayControls())
  
     LED_PORT |= 1 << LED_BIT; // Faster than using digitalWrite
-    PWM_VALUE = (output + (sDelayBuffer[nDelayCounter]))>>1;
-   
-    // add the new output to the buffer so we can use it when the buffer next wraps around
-    sDelayBuffer[nDelayCounter] = PWM_VALUE;
-    nDelayCounter++;
-    if(nDelayCounter == MAX_DELAY){
-      nDelayCounter = 0;
-    }
+    output = echo.process(output);
   }
   else{
     LED_PORT &= ~(1 << LED_BIT); // Faster than using digitalWrite
-    PWM_VALUE = output;
   }
+  return output;
+}
+
+#if AUDIO_BLOCK
 
-  // Output to PWM (this is faster than using analogWrite)  
-  // PWM_VALUE = output;
+SIGNAL(PWM_INTERRUPT)
+{
+  uint16_t stamp = telemetryStamp();
+  // Output to PWM (this is faster than using analogWrite)
+  uint8_t tail = audioTail;
+  PWM_VALUE = audioFifo[tail];
+  tail = (tail + 1) & (AUDIO_FIFO - 1);
+  audioTail = tail;
+  // Half of the FIFO is free again, have the next block rendered into it
+  if ((tail & (AUDIO_BLOCK - 1)) == 0 && !audioRendering) TIMSK3 |= _BV(OCIE3A);
+  // Inside a block its time counts with the block
+  if (!audioRendering) telemetryAudio(stamp, 0);
+}
+
+SIGNAL(RENDER_INTERRUPT)
+{
+  TIMSK3 &= ~_BV(OCIE3A);
+  audioRendering = true;
+  uint8_t head = audioHead;
+  // Render while the overflow is playing from the other half. The check runs 
+  // with interrupts off so a half boundary passed during the last block is 
+  // never missed.
+  do {
+    sei();
+    uint16_t stamp = telemetryStamp();
+    for (uint8_t n = 0; n < AUDIO_BLOCK; n++) {
+      audioFifo[head + n] = renderSample();
+    }
+    telemetryAudio(stamp, AUDIO_BLOCK);
+    cli();
+    head = (head + AUDIO_BLOCK) & (AUDIO_FIFO - 1);
+  } while ((audioTail ^ head) & AUDIO_BLOCK);
+  audioHead = head;
+  audioRendering = false;
 }
+
+#else
+
+SIGNAL(PWM_INTERRUPT)
+{
+  uint16_t stamp = telemetryStamp();
+  // Output to PWM (this is faster than using analogWrite)
+  PWM_VALUE = renderSample();
+  telemetryAudio(stamp, 1);
+}
+
+#endif
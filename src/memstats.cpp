@@ -0,0 +1,36 @@
+#include "memstats.h"
+
+// Ends of the static data and the stack, from the linker script
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+// Paint the free RAM. Runs in .init1, before the stack pointer and r1 are set
+// up, so it is plain assembler.
+extern "C" void stackPaint() __attribute__((naked, used, section(".init1")));
+extern "C" void stackPaint(){
+  asm volatile(
+    "    ldi r30, lo8(_end)\n"
+    "    ldi r31, hi8(_end)\n"
+    "    ldi r24, %0\n"
+    "    ldi r25, hi8(__stack)\n"
+    "1:  st Z+, r24\n"
+    "    cpi r30, lo8(__stack)\n"
+    "    cpc r31, r25\n"
+    "    brlo 1b\n"
+    "    breq 1b\n"
+    :: "i"(STACK_CANARY)
+  );
+}
+
+// .data, .bss and .noinit together
+uint16_t staticRam(){
+  return &_end - &__data_start;
+}
+
+// Painted bytes the stack has never reached
+uint16_t stackUnused(){
+  const uint8_t *p = &_end;
+  while(p <= &__stack && *p == STACK_CANARY){p++;}
+  return p - &_end;
+}
@@ -0,0 +1,212 @@
+#include "midi.h"
+#include "clock.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// Receive ring, written by the interrupt, read by loop()
+static volatile uint8_t rxQueue[MIDI_RX_QUEUE];
+static volatile uint8_t rxHead = 0;
+static volatile uint8_t rxTail = 0;
+
+// Transmit ring, written by loop(), read by the interrupt
+static volatile uint8_t txQueue[MIDI_TX_QUEUE];
+static volatile uint8_t txHead = 0;
+static volatile uint8_t txTail = 0;
+
+// Parser state
+static uint8_t runningStatus = 0;
+static uint8_t dataCount = 0;
+static uint8_t firstData;
+static bool inSysex = false;
+static bool sysexOverflow;
+static uint8_t sysex[MIDI_SYSEX_MAX];
+static uint8_t sysexLength = 0;
+
+// SysEx being streamed out by midiTask()
+static const uint8_t *outHeader;
+static uint8_t outHeaderLength;
+static const uint8_t *outData;
+static uint8_t outLength;
+static uint8_t outPos;            // F0 and header bytes sent
+static uint8_t outIndex;          // data bytes sent
+static uint8_t outGroupLeft;      // data bytes of the current group still to go
+static bool outActive = false;
+
+ISR(USART1_RX_vect){
+  uint8_t data = UDR1;
+  if(data >= 0xF8){
+    clockMidi(data);
+    return;
+  }
+  uint8_t next = (rxHead + 1) & (MIDI_RX_QUEUE - 1);
+  if(next == rxTail){return;}       // full, drop it
+  rxQueue[rxHead] = data;
+  rxHead = next;
+}
+
+ISR(USART1_UDRE_vect){
+  uint8_t tail = txTail;
+  if(tail == txHead){
+    UCSR1B &= ~_BV(UDRIE1);
+    return;
+  }
+  UDR1 = txQueue[tail];
+  txTail = (tail + 1) & (MIDI_TX_QUEUE - 1);
+}
+
+void midiBegin(){
+  UBRR1 = F_CPU / 16 / MIDI_BAUD - 1;
+  UCSR1C = _BV(UCSZ11) | _BV(UCSZ10);
+  UCSR1B = _BV(RXEN1) | _BV(RXCIE1) | _BV(TXEN1);
+}
+
+static uint8_t txFree(){
+  return (txTail - txHead - 1) & (MIDI_TX_QUEUE - 1);
+}
+
+static void txPut(uint8_t data){
+  uint8_t head = txHead;
+  txQueue[head] = data;
+  txHead = (head + 1) & (MIDI_TX_QUEUE - 1);
+  UCSR1B |= _BV(UDRIE1);
+}
+
+// Queue a channel message, false if there is no room for it right now
+bool midiSend(uint8_t status, uint8_t data1, uint8_t data2){
+  bool two = (status & 0xE0) != 0xC0;
+  if(outActive || txFree() < (two ? 3 : 2)){return false;}
+  txPut(status);
+  txPut(data1);
+  if(two){txPut(data2);}
+  return true;
+}
+
+// Start sending F0, the header as it is, the data packed, and F7. Both
+// buffers have to stay put until midiSending() turns false.
+bool midiSendSysex(const uint8_t *header, uint8_t headerLength, const uint8_t *data, uint8_t length){
+  if(outActive){return false;}
+  outHeader = header;
+  outHeaderLength = headerLength;
+  outData = data;
+  outLength = length;
+  outPos = 0;
+  outIndex = 0;
+  outGroupLeft = 0;
+  outActive = true;
+  midiTask();
+  return true;
+}
+
+bool midiSending(){
+  return outActive;
+}
+
+// Next byte of the SysEx going out, from F0 to F7
+static uint8_t sysexOutByte(){
+  if(outPos == 0){
+    outPos++;
+    return MIDI_SYSEX;
+  }
+  if(outPos <= outHeaderLength){return outHeader[outPos++ - 1];}
+  if(outGroupLeft){
+    outGroupLeft--;
+    return outData[outIndex++] & 0x7F;
+  }
+  if(outIndex == outLength){return MIDI_SYSEX_END;}
+
+  // Start of a group, first the top bits of its bytes
+  uint8_t left = outLength - outIndex;
+  outGroupLeft = left < 7 ? left : 7;
+  uint8_t top = 0;
+  for(uint8_t i = 0; i < outGroupLeft; i++){
+    if(outData[outIndex + i] & 0x80){top |= 1 << i;}
+  }
+  return top;
+}
+
+// Feed the SysEx going out into the transmit ring, every pass of loop()
+void midiTask(){
+  while(outActive && txFree()){
+    uint8_t data = sysexOutByte();
+    txPut(data);
+    if(data == MIDI_SYSEX_END){outActive = false;}
+  }
+}
+
+// Next complete message from the input, false when there is none yet
+bool midiRead(MidiMessage &m){
+  while(rxTail != rxHead){
+    uint8_t tail = rxTail;
+    uint8_t data = rxQueue[tail];
+    rxTail = (tail + 1) & (MIDI_RX_QUEUE - 1);
+
+    if(data & 0x80){
+      if(data == MIDI_SYSEX){
+        inSysex = true;
+        sysexOverflow = false;
+        sysexLength = 0;
+        runningStatus = 0;
+      }
+      else if(data == MIDI_SYSEX_END){
+        if(inSysex && !sysexOverflow){
+          inSysex = false;
+          m.status = MIDI_SYSEX;
+          m.data1 = m.data2 = 0;
+          return true;
+        }
+        inSysex = false;
+      }
+      else if(data >= 0xF0){
+        // Other system common messages cancel running status and are ignored
+        inSysex = false;
+        runningStatus = 0;
+      }
+      else{
+        inSysex = false;
+        runningStatus = data;
+        dataCount = 0;
+      }
+      continue;
+    }
+
+    if(inSysex){
+      if(sysexLength < MIDI_SYSEX_MAX){sysex[sysexLength++] = data;}
+      else{sysexOverflow = true;}
+      continue;
+    }
+    if(!runningStatus){continue;}
+
+    // Program change and channel pressure take one data byte, the rest two
+    bool two = (runningStatus & 0xE0) != 0xC0;
+    if(two && dataCount == 0){
+      firstData = data;
+      dataCount = 1;
+      continue;
+    }
+    dataCount = 0;
+    m.status = runningStatus;
+    m.data1 = two ? firstData : data;
+    m.data2 = two ? data : 0;
+    return true;
+  }
+  return false;
+}
+
+// Payload of the SysEx midiRead() just returned, between F0 and F7
+const uint8_t *midiSysex(uint8_t *length){
+  *length = sysexLength;
+  return sysex;
+}
+
+// Undo the 7 bit packing, returns the number of bytes written to out
+uint8_t midiUnpack(const uint8_t *in, uint8_t length, uint8_t *out, uint8_t max){
+  uint8_t n = 0;
+  for(uint8_t i = 0; i < length; i += 8){
+    uint8_t top = in[i];
+    for(uint8_t j = 1; j < 8 && i + j < length && n < max; j++){
+      out[n++] = in[i + j] | ((top & (1 << (j - 1))) ? 0x80 : 0);
+    }
+  }
+  return n;
+}
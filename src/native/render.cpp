@@ -0,0 +1,161 @@
+// Offline renderer for the grain engine.
+//
+// Plays a step pattern through the same grain_engine.h code the PWM interrupt
+// uses and writes the result to an 8 bit mono WAV file, so the sound can be
+// checked and the engine profiled without flashing a board.
+//
+//   pio run -e native
+//   .pio/build/native/program [-b bpm] [-r repeats] [-d] pattern.txt out.wav
+//
+// The pattern file holds one step per line, five numbers in the order the
+// voice takes them:  sync_inc grain_inc grain_decay grain2_inc grain2_decay
+// optionally followed by the wavetable of each grain (wavetables.h, default 0)
+// and the bus filter: mode cutoff resonance (bus_filter.h, default off).
+// Blank lines and lines starting with # are skipped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bus_filter.h"
+#include "grain_delay.h"
+#include "grain_engine.h"
+#include "sample_rate.h"
+
+// The board's sample rate (sample_rate.h) rounded for the WAV header, the step
+// timing below takes the exact ratio like clock.cpp
+#define SAMPLE_RATE    ((F_CPU + SAMPLE_DIVIDER / 2) / SAMPLE_DIVIDER)
+
+static void usage(){
+  fprintf(stderr, "usage: render [-b bpm] [-r repeats] [-d] pattern.txt out.wav\n"
+                  "  -b bpm      tempo, 1/16 steps (default 120)\n"
+                  "  -r repeats  times the pattern is played (default 2)\n"
+                  "  -d          delay on, one step at half mix and feedback\n");
+  exit(1);
+}
+
+struct RenderStep {
+  VoiceParams params;
+  FilterParams filter;
+};
+
+static bool loadPattern(const char *path, std::vector<RenderStep> &steps){
+  FILE *f = fopen(path, "r");
+  if(!f){return false;}
+  char line[256];
+  while(fgets(line, sizeof(line), f)){
+    unsigned sync, grain, decay, grain2, decay2, wave = 0, wave2 = 0, mode = 0, cutoff = 0, resonance = 0;
+    if(line[0] == '#'){continue;}
+    if(sscanf(line, "%u %u %u %u %u %u %u %u %u %u", &sync, &grain, &decay, &grain2, &decay2,
+              &wave, &wave2, &mode, &cutoff, &resonance) < 5){continue;}
+    RenderStep s;
+    VoiceParams &p = s.params;
+    p.syncPhaseInc = sync;
+    p.grainPhaseInc = grain;
+    p.grainDecay = decay;
+    p.grain2PhaseInc = grain2;
+    p.grain2Decay = decay2;
+    p.grainWave = wave % WAVES;
+    p.grain2Wave = wave2 % WAVES;
+    filterParams(s.filter, mode, cutoff, resonance);
+    steps.push_back(s);
+  }
+  fclose(f);
+  return !steps.empty();
+}
+
+static void put16(FILE *f, uint16_t v){fputc(v & 0xff, f); fputc(v >> 8, f);}
+static void put32(FILE *f, uint32_t v){put16(f, v & 0xffff); put16(f, v >> 16);}
+
+static bool writeWav(const char *path, const std::vector<uint8_t> &samples){
+  FILE *f = fopen(path, "wb");
+  if(!f){return false;}
+  uint32_t size = samples.size();
+  fwrite("RIFF", 1, 4, f); put32(f, 36 + size);
+  fwrite("WAVEfmt ", 1, 8, f); put32(f, 16);
+  put16(f, 1);              // PCM
+  put16(f, 1);              // mono
+  put32(f, SAMPLE_RATE);
+  put32(f, SAMPLE_RATE);    // bytes per second
+  put16(f, 1);              // block align
+  put16(f, 8);              // bits per sample, unsigned
+  fwrite("data", 1, 4, f); put32(f, size);
+  fwrite(samples.data(), 1, size, f);
+  return fclose(f) == 0;
+}
+
+int main(int argc, char **argv){
+  int bpm = 120;
+  int repeats = 2;
+  bool delay = false;
+
+  int arg = 1;
+  for(; arg < argc && argv[arg][0] == '-'; arg++){
+    if(!strcmp(argv[arg], "-b") && arg + 1 < argc){bpm = atoi(argv[++arg]);}
+    else if(!strcmp(argv[arg], "-r") && arg + 1 < argc){repeats = atoi(argv[++arg]);}
+    else if(!strcmp(argv[arg], "-d")){delay = true;}
+    else{usage();}
+  }
+  if(argc - arg != 2 || bpm <= 0 || repeats <= 0){usage();}
+
+  std::vector<RenderStep> steps;
+  if(!loadPattern(argv[arg], steps)){
+    fprintf(stderr, "render: no steps in %s\n", argv[arg]);
+    return 1;
+  }
+
+  static GrainEngine<GRAIN_VOICES> synth;
+  static BusFilter busFilter;
+  static GrainDelay<DELAY_BITS, DELAY_PACK, DELAY_DECIMATE, DELAY_TAPS> echo;
+  static uint8_t delayRam[DELAY_BYTES];
+  uint8_t voice = 0;
+  std::vector<uint8_t> out;
+
+  // Same step timing as the firmware clock: F_CPU*15/(510*bpm) samples per
+  // step with the remainder carried over. Every step goes to the next voice
+  // round robin and is taken on at that voice's next grain boundary, or at once
+  // when the voice has gone silent, just like the interrupt does.
+  uint32_t divisor = (uint32_t)SAMPLE_DIVIDER * bpm;
+  uint32_t whole = F_CPU * 15 / divisor;
+  uint32_t remainder = F_CPU * 15 % divisor;
+  uint32_t error = 0;
+  const RenderStep *pending = NULL;
+
+  echo.begin(delayRam);
+  echo.setTime(whole);
+  echo.feedback = 128;
+  echo.mix = 128;
+
+  for(int r = 0; r < repeats; r++){
+    for(size_t s = 0; s < steps.size(); s++){
+      pending = &steps[s];
+      voice = (voice + 1 == GRAIN_VOICES) ? 0 : voice + 1;
+      uint32_t length = whole;
+      error += remainder;
+      if(error >= divisor){error -= divisor; length++;}
+
+      for(uint32_t i = 0; i < length; i++){
+        for(uint8_t v = 0; v < GRAIN_VOICES; v++){
+          GrainVoice &gv = synth.voice[v];
+          bool boundary = grainSync(gv) || gv.syncPhaseInc == 0;
+          if(pending && v == voice && (boundary || synth.silent(v))){
+            synth.trigger(v, pending->params);
+            busFilter.set(pending->filter);
+            if(!boundary){synth.retrigger(v);}
+            pending = NULL;
+          }
+        }
+        uint8_t sample = busFilter.process(synth.mix());
+        out.push_back(delay ? echo.process(sample) : sample);
+      }
+    }
+  }
+
+  if(!writeWav(argv[arg + 1], out)){
+    fprintf(stderr, "render: cannot write %s\n", argv[arg + 1]);
+    return 1;
+  }
+  printf("%s: %u samples, %.2f s\n", argv[arg + 1], (unsigned)out.size(), out.size() / (double)SAMPLE_RATE);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include "quantizer.h"
+
+#include <avr/pgmspace.h>
+
+#include "sample_rate.h"
+
+#define SCALE_STEPS 128
+
+static constexpr uint16_t scaleMasks[SCALES] = {
+  0xFFF,            // chromatic
+  0xAB5,            // major: 0 2 4 5 7 9 11
+  0x5AD,            // natural minor: 0 2 3 5 7 8 10
+  0x295,            // major pentatonic: 0 2 4 7 9
+  SCALE_USER_MASK,
+};
+
+// 2^(n/12)
+static constexpr double semitoneRatio[12] = {
+  1.0, 1.0594630943592953, 1.122462048309373, 1.189207115002721,
+  1.2599210498948732, 1.3348398541700344, 1.4142135623730951, 1.4983070768766815,
+  1.5874010519681994, 1.6817928305074290, 1.7817974362806785, 1.8877486253633868
+};
+
+// Sync phase increment of MIDI note n at the PWM sample rate. The original
+// midiTable was worked out for 31250Hz and played everything 7 cents sharp.
+static constexpr uint16_t noteInc(int n){
+  return 8.175798915643707 * semitoneRatio[n % 12] * (1 << (n / 12)) * 65536.0 / SAMPLE_RATE_HZ + 0.5;
+}
+
+static constexpr bool inScale(int note, uint16_t mask, int root){
+  return mask & (1 << ((note - root + 12) % 12));
+}
+
+// Nearest note of the scale to position p, the lower one on a tie
+static constexpr int nearestNote(int p, uint16_t mask, int root){
+  for(int d = 0; d < 12; d++){
+    if(p - d >= 0 && inScale(p - d, mask, root)){return p - d;}
+    if(p + d < SCALE_STEPS && inScale(p + d, mask, root)){return p + d;}
+  }
+  return p;
+}
+
+struct ScaleTables {
+  uint16_t inc[SCALES][12][SCALE_STEPS];
+
+  constexpr ScaleTables() : inc() {
+    for(int s = 0; s < SCALES; s++){
+      for(int r = 0; r < 12; r++){
+        // Position 0 stays 0, the rest
+        for(int p = 1; p < SCALE_STEPS; p++){
+          inc[s][r][p] = noteInc(nearestNote(p, scaleMasks[s], r));
+        }
+      }
+    }
+  }
+};
+
+static constexpr ScaleTables scaleTables PROGMEM = ScaleTables();
+
+// Position p of the chromatic C table is MIDI note p, the same in the AVR's
+// 32 bit double as in a host's 64 bit one. Spot checks at both ends, middle C
+// and A440, then a snap in C major.
+static_assert(scaleTables.inc[0][0][1] == 18, "note 1");
+static_assert(scaleTables.inc[0][0][60] == 547, "middle C");
+static_assert(scaleTables.inc[0][0][69] == 919, "A440");
+static_assert(scaleTables.inc[0][0][122] == 19631, "note 122");
+static_assert(scaleTables.inc[0][0][127] == 26204, "note 127");
+static_assert(scaleTables.inc[1][0][61] == 547, "C# snaps down to C in C major");
+
+static const uint16_t *scaleTable = scaleTables.inc[SCALE_DEFAULT][SCALE_ROOT];
+
+void setScale(uint8_t scale, uint8_t root){
+  scaleTable = scaleTables.inc[scale][root];
+}
+
+// ADC reading (0-1023) to sync phase increment
+uint16_t quantize(uint16_t input){
+  return pgm_read_word(&scaleTable[(1023 - input) >> 3]);
+}
+
+static const char scaleName0[] PROGMEM = "chromatic";
+static const char scaleName1[] PROGMEM = "major";
+static const char scaleName2[] PROGMEM = "minor";
+static const char scaleName3[] PROGMEM = "pentatonic";
+static const char scaleName4[] PROGMEM = "user";
+static const char *const scaleNames[SCALES] PROGMEM = {
+  scaleName0, scaleName1, scaleName2, scaleName3, scaleName4
+};
+
+const __FlashStringHelper *scaleName(uint8_t scale){
+  return (const __FlashStringHelper *)pgm_read_word(&scaleNames[scale]);
+}
+
+// Root names two characters each, padded with a space
+static const char rootNames[] PROGMEM = "C C#D D#E F F#G G#A A#B ";
+
+void printRoot(Print &out, uint8_t root){
+  out.write(pgm_read_byte(&rootNames[2 * root]));
+  char sharp = pgm_read_byte(&rootNames[2 * root + 1]);
+  if(sharp != ' '){out.write(sharp);}
+}
@@ -0,0 +1,116 @@
+#include "telemetry.h"
+
+#ifdef TELEMETRY
+
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "memstats.h"
+
+#define CYCLES_PER_US   (F_CPU / 1000000UL)
+#define WINDOW_CYCLES   F_CPU     // one second
+
+Telemetry telemetry;
+
+static volatile uint16_t clockHigh = 0;
+static uint32_t lastLoop = 0;
+static uint32_t windowStart = 0;
+
+ISR(TIMER4_OVF_vect){
+  clockHigh++;
+}
+
+// 32 bit cycle count, wraps every 4.5 minutes
+uint32_t telemetryClock(){
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t high = clockHigh;
+  uint16_t low = TCNT4;
+  // An overflow that hasn't been counted yet
+  if((TIFR4 & _BV(TOV4)) && low < 0x8000){high++;}
+  SREG = sreg;
+  return (uint32_t)high << 16 | low;
+}
+
+static uint16_t cyclesToUs(uint32_t cycles){
+  cycles /= CYCLES_PER_US;
+  return (cycles > 0xFFFF) ? 0xFFFF : cycles;
+}
+
+void telemetryReset(){
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    telemetry.sampleMax = 0;
+    for(uint8_t i = 0; i < TELEMETRY_BINS; i++){telemetry.sampleHist[i] = 0;}
+  }
+  telemetry.loopMin = 0xFFFF;
+  telemetry.loopMax = 0;
+  telemetry.stepLateMax = 0;
+  telemetry.stepsLate = 0;
+  telemetry.stepsMissed = 0;
+}
+
+void telemetryBegin(){
+  telemetryReset();
+  // Timer 4 free running, normal mode, no prescaler
+  TCCR4A = 0;
+  TCCR4B = _BV(CS40);
+  TIMSK4 = _BV(TOIE4);
+  lastLoop = windowStart = telemetryClock();
+}
+
+// Top of every pass of loop()
+void telemetryLoop(){
+  uint32_t now = telemetryClock();
+  uint16_t period = cyclesToUs(now - lastLoop);
+  lastLoop = now;
+  if(period < telemetry.loopMin){telemetry.loopMin = period;}
+  if(period > telemetry.loopMax){telemetry.loopMax = period;}
+  telemetry.loopTotal += period;
+  telemetry.loopCount++;
+
+  // Close the second
+  uint32_t window = now - windowStart;
+  if(window < WINDOW_CYCLES){return;}
+  windowStart = now;
+  uint32_t busy;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    busy = telemetry.audioBusy;
+    telemetry.audioBusy = 0;
+  }
+  telemetry.audioLoad = busy / (window / 100);
+  telemetry.loopAvg = telemetry.loopTotal / telemetry.loopCount;
+  telemetry.loopTotal = 0;
+  telemetry.loopCount = 0;
+  telemetry.stackFree = stackUnused();
+}
+
+// loop() is playing a step, with backlog steps raised it had not taken yet
+// (this one included)
+void telemetryStepTaken(uint8_t backlog){
+  uint32_t raised;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+    raised = telemetry.stepRaised;
+  }
+  if(backlog > 1){telemetry.stepsMissed++;}
+  // Late as measured from the newest step raised, the older ones waited longer
+  uint16_t late = cyclesToUs(telemetryClock() - raised);
+  if(late > telemetry.stepLateMax){telemetry.stepLateMax = late;}
+  if(late > TELEMETRY_LATE_US){telemetry.stepsLate++;}
+}
+
+// Line 0 "A45% P412 S2310": audio load, worst sample in cycles and stack
+// never used. Line 1 "L812us 3/0": worst loop() pass, steps late/missed.
+void telemetryShow(Print &out, uint8_t line){
+  if(line == 0){
+    out.print('A'); out.print(telemetry.audioLoad);
+    out.print(F("% P")); out.print(telemetry.sampleMax);
+    out.print(F(" S")); out.print(telemetry.stackFree);
+  }
+  else{
+    out.print('L'); out.print(telemetry.loopMax);
+    out.print(F("us ")); out.print(telemetry.stepsLate);
+    out.print('/'); out.print(telemetry.stepsMissed);
+  }
+}
+
+#endif
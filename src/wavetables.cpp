@@ -0,0 +1,64 @@
+#include "wavetables.h"
+
+// Host and board alike, the native renderer links this file as well
+
+#define WAVE_PI 3.14159265358979323846
+
+// sin(x) for any x, from its Taylor series around the nearest multiple of 2pi
+static constexpr double waveSin(double x){
+  while(x > WAVE_PI){x -= 2 * WAVE_PI;}
+  while(x < -WAVE_PI){x += 2 * WAVE_PI;}
+  double term = x, sum = x;
+  for(int n = 1; n < 12; n++){
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+// -1..1 onto 0..255
+static constexpr uint8_t waveByte(double y){
+  return (y >= 1.0) ? 255 : (y <= -1.0) ? 0 : (uint8_t)(127.5 * (y + 1.0) + 0.5);
+}
+
+static constexpr int userHarmonics[] = {WAVE_USER_HARMONICS};
+static constexpr int userCount = sizeof(userHarmonics) / sizeof(userHarmonics[0]);
+
+static constexpr double userScale(){
+  double total = 0;
+  for(int h = 0; h < userCount; h++){total += userHarmonics[h] < 0 ? -userHarmonics[h] : userHarmonics[h];}
+  return total ? 1.0 / total : 0;
+}
+
+static constexpr uint8_t waveSample(int wave, int i){
+  double x = 2 * WAVE_PI * i / 256;
+  double y = 0;
+  switch(wave){
+    case WAVE_TRIANGLE:
+      // Exactly the grain of the original sketch, which folded the phase
+      return (i < 128) ? 2 * i : 511 - 2 * i;
+    case WAVE_SINE:     return waveByte(waveSin(x));
+    case WAVE_SAW:      return i;
+    case WAVE_SQUARE:   return (i < 128) ? 255 : 0;
+    case WAVE_PULSE:    return (i < 64) ? 255 : 0;
+    case WAVE_FORMANT:  return waveByte(0.5 * (1 - waveSin(x + WAVE_PI / 2)) * waveSin(4 * x));
+    case WAVE_FORMANT2: return waveByte(0.5 * (1 - waveSin(x + WAVE_PI / 2)) * waveSin(7 * x));
+    case WAVE_USER:
+      for(int h = 0; h < userCount; h++){y += userHarmonics[h] * waveSin((h + 1) * x);}
+      return waveByte(y * userScale());
+  }
+  return 0;
+}
+
+constexpr WaveTables::WaveTables() : wave() {
+  for(int w = 0; w < WAVES; w++){
+    for(int i = 0; i < 256; i++){wave[w][i] = waveSample(w, i);}
+  }
+}
+
+constexpr WaveTables waveTables PROGMEM = WaveTables();
+
+// The series sine crosses and peaks where it should
+static_assert(waveTables.wave[WAVE_SINE][0] == 128, "sine at 0");
+static_assert(waveTables.wave[WAVE_SINE][64] == 255, "sine at pi/2");
+static_assert(waveTables.wave[WAVE_SINE][192] == 0, "sine at 3pi/2");
@@ -0,0 +1,209 @@
+// Saturating and widening helpers of fixmath.h against references worked out
+// independently of them, in plain int32 arithmetic.
+//
+//   pio test -e native     on the PC
+//   pio test -e simavr     on a simulated Mega, the AVR assembly itself
+//
+// satAddS16, satSubS16, mulU8 and mulS16U8 are assembly on the AVR. On the PC
+// their C fallbacks are the very int32 formulas a reference would use, so
+// there the sweeps run a model of the assembly instead, instruction by
+// instruction with the flags as the AVR instruction set defines them. Under
+// simavr the sweeps run the assembly, every operand pair of it. The two 16
+// bit saturating sweeps are four billion pairs each, which makes that a long
+// run.
+//
+// satAddU16, satAddU8 and satSubU16 are plain C everywhere. The PC checks
+// them on every pair; the simulated board runs satAddU8 on every pair and
+// the 16 bit ones on every high byte with the low bytes where the carries
+// and the sign turn over, which is enough to catch the compiler getting the
+// carry test wrong.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <unity.h>
+
+#include "fixmath.h"
+
+#ifdef __AVR__
+static const uint8_t lowBytes[] = {0x00, 0x01, 0x7F, 0x80, 0xFE, 0xFF};
+#define LOW_BYTES sizeof(lowBytes)
+
+// The next operand for the plain C helpers, false once the sweep is through
+static bool nextC16(uint16_t &v){
+  uint8_t i = 0;
+  while(lowBytes[i] != (v & 0xFF)){i++;}
+  if(++i < LOW_BYTES){
+    v = (v & 0xFF00) | lowBytes[i];
+    return true;
+  }
+  if(v >> 8 == 0xFF){return false;}
+  v = (v & 0xFF00) + 0x100;
+  return true;
+}
+
+static inline int16_t asmSatAddS16(int16_t a, int16_t b){return satAddS16(a, b);}
+static inline int16_t asmSatSubS16(int16_t a, int16_t b){return satSubS16(a, b);}
+static inline uint16_t asmMulU8(uint8_t a, uint8_t b){return mulU8(a, b);}
+static inline int16_t asmMulS16U8(int16_t a, uint8_t b){return mulS16U8(a, b);}
+#else
+static bool nextC16(uint16_t &v){
+  return ++v != 0;
+}
+
+// add, adc: V = Rd7 Rr7 !R7 + !Rd7 !Rr7 R7 of the high bytes. brvc, then
+// ldi 0x7FFF, which leaves N alone, brmi, ldi 0x8000.
+static int16_t asmSatAddS16(int16_t a, int16_t b){
+  uint16_t r = (uint16_t)a + (uint16_t)b;
+  uint8_t d = (uint16_t)a >> 8, s = (uint16_t)b >> 8, h = r >> 8;
+  bool v = (d & s & ~h & 0x80) || (~d & ~s & h & 0x80);
+  bool n = h & 0x80;
+  if(!v){return r;}
+  return n ? 0x7FFF : -0x8000;
+}
+
+// sub, sbc: V = Rd7 !Rr7 !R7 + !Rd7 Rr7 R7, the rest as above
+static int16_t asmSatSubS16(int16_t a, int16_t b){
+  uint16_t r = (uint16_t)a - (uint16_t)b;
+  uint8_t d = (uint16_t)a >> 8, s = (uint16_t)b >> 8, h = r >> 8;
+  bool v = (d & ~s & ~h & 0x80) || (~d & s & h & 0x80);
+  bool n = h & 0x80;
+  if(!v){return r;}
+  return n ? 0x7FFF : -0x8000;
+}
+
+// mul into r1:r0, movw. The hardware multiply is the whole of it, so only
+// the board tests anything here.
+static uint16_t asmMulU8(uint8_t a, uint8_t b){
+  return (uint16_t)a * b;
+}
+
+// mul of the low byte, keep r1; mulsu of the high byte, signed, into r1:r0;
+// add r0 to the low byte; mov r1 to the high byte; clr r1, which leaves the
+// carry; adc of the zero register
+static int16_t asmMulS16U8(int16_t a, uint8_t b){
+  uint16_t low = (uint8_t)a * b;
+  uint16_t high = (uint16_t)((int8_t)((uint16_t)a >> 8) * b);
+  uint16_t sum = (low >> 8) + (high & 0xFF);
+  uint8_t r0 = sum, r1 = (high >> 8) + (sum >> 8);
+  return (int16_t)(r0 | r1 << 8);
+}
+#endif
+
+static bool next16(uint16_t &v){
+  return ++v != 0;
+}
+
+static int32_t clamp(int32_t v, int32_t lo, int32_t hi){
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+// a * b / 256 rounded towards minus infinity, without a shift of a negative
+static int32_t floorDiv256(int32_t v){
+  int32_t q = v / 256;
+  return (q * 256 > v) ? q - 1 : q;
+}
+
+// Only the first pair that differs is reported, the test stops there
+static inline void check(int32_t got, int32_t want, int32_t a, int32_t b){
+  if(got != want){
+    char pair[40];
+    snprintf(pair, sizeof(pair), "a %ld b %ld", (long)a, (long)b);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(want, got, pair);
+  }
+}
+
+void test_satAddU16(){
+  uint16_t a = 0;
+  do{
+    uint16_t b = 0;
+    do{
+      check(satAddU16(a, (int16_t)b), clamp((int32_t)a + (int16_t)b, 0, 65535), a, (int16_t)b);
+    }while(nextC16(b));
+  }while(nextC16(a));
+}
+
+void test_satAddU8(){
+  for(int32_t a = 0; a <= 255; a++){
+    for(int32_t b = -128; b <= 127; b++){
+      check(satAddU8(a, b), clamp(a + b, 0, 255), a, b);
+    }
+  }
+}
+
+void test_satSubU16(){
+  uint16_t a = 0;
+  do{
+    uint16_t b = 0;
+    do{
+      check(satSubU16(a, b), clamp((int32_t)a - b, 0, 65535), a, b);
+    }while(nextC16(b));
+  }while(nextC16(a));
+}
+
+void test_satAddS16(){
+  uint16_t a = 0;
+  do{
+    uint16_t b = 0;
+    do{
+      check(asmSatAddS16(a, b), clamp((int32_t)(int16_t)a + (int16_t)b, -32768, 32767), (int16_t)a, (int16_t)b);
+    }while(next16(b));
+  }while(next16(a));
+}
+
+void test_satSubS16(){
+  uint16_t a = 0;
+  do{
+    uint16_t b = 0;
+    do{
+      check(asmSatSubS16(a, b), clamp((int32_t)(int16_t)a - (int16_t)b, -32768, 32767), (int16_t)a, (int16_t)b);
+    }while(next16(b));
+  }while(next16(a));
+}
+
+void test_mulU8(){
+  for(int32_t a = 0; a <= 255; a++){
+    for(int32_t b = 0; b <= 255; b++){
+      check(asmMulU8(a, b), a * b, a, b);
+    }
+  }
+}
+
+// The product always fits, the result rounds towards minus infinity
+void test_mulS16U8(){
+  uint16_t a = 0;
+  do{
+    for(int32_t b = 0; b <= 255; b++){
+      check(asmMulS16U8(a, b), floorDiv256((int32_t)(int16_t)a * b), (int16_t)a, b);
+    }
+  }while(next16(a));
+}
+
+void setUp(){}
+void tearDown(){}
+
+static int runTests(){
+  UNITY_BEGIN();
+  RUN_TEST(test_satAddU16);
+  RUN_TEST(test_satAddU8);
+  RUN_TEST(test_satSubU16);
+  RUN_TEST(test_mulU8);
+  RUN_TEST(test_mulS16U8);
+  RUN_TEST(test_satAddS16);
+  RUN_TEST(test_satSubS16);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup(){
+  runTests();
+}
+
+void loop(){}
+#else
+int main(){
+  return runTests();
+}
+#endif
@@ -0,0 +1,242 @@
+// Cycle counts of the PWM interrupt under simavr.
+//
+// Runs a firmware built with -D ISR_BENCH (see the isrbench environment in
+// platformio.ini) on a simulated ATmega2560 and times every TIMER3_OVF
+// interrupt from its vector to the RETI. The bench firmware plays a fixed
+// pattern whose 16 steps sweep the sync and grain settings; the step LEDs tell
+// which one is sounding, so the counts are broken down per step. Everything
+// runs twice, with the echo off and then on, turned up the way it is on the
+// panel: button 33 tapped over to the mix and held while pot 15 goes to half.
+//
+// With block rendering the samples are computed in the TIMER3_COMPA interrupt,
+// which runs with interrupts enabled. Its time is counted without the
+// interrupts nested inside it and spread over the samples of a block, so the
+// per sample figures compare directly with a build that renders in the
+// overflow interrupt.
+//
+//   isrbench firmware.elf [budget] [seconds]
+//
+// Exits with status 1 when the worst case goes over the cycle budget.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_adc.h>
+
+#define CPU_FREQ      16000000
+#define VCC_MV        5000
+#define PWM_VECTOR    35          // TIMER3_OVF
+#define RENDER_VECTOR 32          // TIMER3_COMPA
+#define VECTORS       57
+#define MAX_NESTING   8
+#define OPCODE_RETI   0x9518
+#define STEPS         16
+#define BUCKET        16
+#define BUCKETS       48          // up to 768 cycles
+
+// Data space addresses of the step LED ports
+#define PORTB_ADDR    0x25
+#define PORTD_ADDR    0x2B
+#define PORTG_ADDR    0x34
+#define PORTL_ADDR    0x10B
+
+typedef struct {
+  unsigned long count;
+  unsigned long long total;
+  unsigned min, max;
+} stats_t;
+
+static stats_t perStep[STEPS + 1];   // [STEPS] collects samples with no LED lit
+static unsigned long histogram[BUCKETS + 1];
+
+// Render interrupt bookkeeping: the last block's cost is spread over the
+// overflows, pwmCount / renderCount of them per block
+static unsigned long renderCount, pwmCount;
+static unsigned lastRender, renderMax;
+
+// Step (0-15) shown on the LEDs, STEPS if none. Inverse of ledShow().
+static int currentStep(avr_t *avr){
+  static const struct { uint16_t addr; uint8_t bit; uint8_t step; } map[STEPS] = {
+    {PORTB_ADDR,0,0},{PORTB_ADDR,2,1},{PORTL_ADDR,0,2},{PORTL_ADDR,2,3},
+    {PORTL_ADDR,4,4},{PORTL_ADDR,6,5},{PORTG_ADDR,0,6},{PORTG_ADDR,2,7},
+    {PORTB_ADDR,1,8},{PORTB_ADDR,3,9},{PORTL_ADDR,1,10},{PORTL_ADDR,3,11},
+    {PORTL_ADDR,5,12},{PORTL_ADDR,7,13},{PORTG_ADDR,1,14},{PORTD_ADDR,7,15},
+  };
+  for(int i = 0; i < STEPS; i++){
+    if(avr->data[map[i].addr] & (1 << map[i].bit)){return map[i].step;}
+  }
+  return STEPS;
+}
+
+static void record(int step, unsigned cycles){
+  stats_t *s = &perStep[step];
+  if(s->count == 0 || cycles < s->min){s->min = cycles;}
+  if(cycles > s->max){s->max = cycles;}
+  s->count++;
+  s->total += cycles;
+  unsigned b = cycles / BUCKET;
+  histogram[b > BUCKETS ? BUCKETS : b]++;
+}
+
+static void pin(avr_t *avr, char port, int bit, int level){
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), bit), level);
+}
+
+// Pot on analog input channel at mv millivolts
+static void pot(avr_t *avr, int channel, uint32_t mv){
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + channel), mv);
+}
+
+static void run(avr_t *avr, double seconds){
+  struct { int vector; avr_cycle_count_t start, nested; int step; } stack[MAX_NESTING];
+  int depth = 0;
+  avr_cycle_count_t end = avr->cycle + (avr_cycle_count_t)(seconds * CPU_FREQ);
+
+  while(avr->cycle < end){
+    avr_flashaddr_t pc = avr->pc;
+    int reti = 0;
+    if(depth){
+      uint16_t op = avr->flash[pc] | (avr->flash[pc + 1] << 8);
+      reti = (op == OPCODE_RETI);
+    }
+    int state = avr_run(avr);
+    if(state == cpu_Done || state == cpu_Crashed){
+      fprintf(stderr, "isrbench: simulation stopped (state %d)\n", state);
+      exit(2);
+    }
+
+    if(reti){
+      depth--;
+      avr_cycle_count_t elapsed = avr->cycle - stack[depth].start;
+      unsigned own = (unsigned)(elapsed - stack[depth].nested);
+      if(depth){stack[depth - 1].nested += elapsed;}
+      if(stack[depth].vector == PWM_VECTOR){
+        // Each sample pays for its overflow plus its share of the last block
+        unsigned block = renderCount ? pwmCount / renderCount : 1;
+        pwmCount++;
+        record(stack[depth].step, own + lastRender / (block ? block : 1));
+      }
+      else if(stack[depth].vector == RENDER_VECTOR){
+        lastRender = own;
+        renderCount++;
+        if(own > renderMax){renderMax = own;}
+      }
+    }
+    else if(avr->pc < VECTORS * 4 && pc >= VECTORS * 4 && depth < MAX_NESTING){
+      // Jumped into the vector table: an interrupt was taken
+      stack[depth].vector = avr->pc / 4;
+      stack[depth].start = avr->cycle;
+      stack[depth].nested = 0;
+      stack[depth].step = currentStep(avr);
+      depth++;
+    }
+  }
+}
+
+static unsigned report(const char *title){
+  stats_t all = {0, 0, 0, 0};
+  printf("\n%s\n step   count    min    max   mean\n", title);
+  for(int i = 0; i <= STEPS; i++){
+    stats_t *s = &perStep[i];
+    if(!s->count){continue;}
+    if(i < STEPS){printf("%5d", i + 1);} else {printf(" idle");}
+    printf(" %7lu %6u %6u %6.1f\n", s->count, s->min, s->max, (double)s->total / s->count);
+    if(all.count == 0 || s->min < all.min){all.min = s->min;}
+    if(s->max > all.max){all.max = s->max;}
+    all.count += s->count;
+    all.total += s->total;
+  }
+  if(!all.count){
+    printf("  no interrupts seen\n");
+    return 0;
+  }
+  printf("  all %7lu %6u %6u %6.1f\n", all.count, all.min, all.max, (double)all.total / all.count);
+  if(renderCount){
+    printf(" rendered in blocks of %lu samples, worst block %u cycles\n", pwmCount / renderCount, renderMax);
+  }
+  printf("\n cycles    count\n");
+  for(int b = 0; b <= BUCKETS; b++){
+    if(!histogram[b]){continue;}
+    if(b < BUCKETS){printf(" %3d-%-3d %8lu\n", b * BUCKET, b * BUCKET + BUCKET - 1, histogram[b]);}
+    else{printf(" %3d+    %8lu\n", b * BUCKET, histogram[b]);}
+  }
+  memset(perStep, 0, sizeof(perStep));
+  memset(histogram, 0, sizeof(histogram));
+  renderMax = 0;
+  return all.max;
+}
+
+int main(int argc, char **argv){
+  if(argc < 2){
+    fprintf(stderr, "usage: isrbench firmware.elf [budget] [seconds]\n");
+    return 2;
+  }
+  unsigned budget = argc > 2 ? atoi(argv[2]) : 400;
+  double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+  if(elf_read_firmware(argv[1], &firmware)){
+    fprintf(stderr, "isrbench: cannot load %s\n", argv[1]);
+    return 2;
+  }
+  avr_t *avr = avr_make_mcu_by_name("atmega2560");
+  if(!avr){
+    fprintf(stderr, "isrbench: simavr has no atmega2560\n");
+    return 2;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = CPU_FREQ;
+  avr->vcc = avr->avcc = avr->aref = VCC_MV;
+
+  // Nothing pressed, internal clock (27 up), live tweaks off (31 down)
+  for(int bit = 0; bit < 8; bit++){
+    pin(avr, 'A', bit, 1);
+    pin(avr, 'C', bit, 1);
+  }
+  pin(avr, 'C', 6, 0);
+
+  run(avr, 0.5);                  // boot, LCD init
+  memset(perStep, 0, sizeof(perStep));
+  memset(histogram, 0, sizeof(histogram));
+  renderMax = 0;
+  unsigned worst = 0, max;
+
+  run(avr, seconds);
+  max = report("echo off");
+  if(max > worst){worst = max;}
+
+  // Two taps of 33 step the delay control from time over feedback to mix,
+  // then with 33 held pot 15 at half travel sets a mix of 128. Every press
+  // and release gets time to debounce.
+  for(int tap = 0; tap < 2; tap++){
+    pin(avr, 'C', 4, 0);
+    run(avr, 0.05);
+    pin(avr, 'C', 4, 1);
+    run(avr, 0.05);
+  }
+  pin(avr, 'C', 4, 0);
+  run(avr, 0.05);
+  pot(avr, 15, VCC_MV / 2 + 10);
+  run(avr, 0.05);
+  pin(avr, 'C', 4, 1);
+  run(avr, 0.05);
+  memset(perStep, 0, sizeof(perStep));
+  memset(histogram, 0, sizeof(histogram));
+  renderMax = 0;
+  run(avr, seconds);
+  max = report("echo on");
+  if(max > worst){worst = max;}
+
+  printf("\nworst case %u cycles, budget %u of %d per sample\n", worst, budget, 510);
+  if(worst > budget){
+    printf("FAILED: over budget\n");
+    return 1;
+  }
+  return 0;
+}
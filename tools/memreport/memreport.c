@@ -0,0 +1,101 @@
+// Peak stack use of the firmware under simavr.
+//
+// The firmware paints its free RAM at boot (src/memstats.cpp). This runs it
+// on a simulated ATmega2560 with the panel idle and then with the echo turned
+// up through its control, and counts the canary bytes the stack never
+// overwrote.
+//
+//   memreport firmware.elf end [seconds]
+//
+// end is the address of the _end symbol, where the static data stops.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_adc.h>
+
+#define CPU_FREQ      16000000
+#define VCC_MV        5000
+#define STACK_CANARY  0xC5
+#define RAM_START     0x200
+
+static void pin(avr_t *avr, char port, int bit, int level){
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(port), bit), level);
+}
+
+// Pot on analog input channel at mv millivolts
+static void pot(avr_t *avr, int channel, uint32_t mv){
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + channel), mv);
+}
+
+static void run(avr_t *avr, double seconds){
+  avr_cycle_count_t end = avr->cycle + (avr_cycle_count_t)(seconds * CPU_FREQ);
+  while(avr->cycle < end){
+    int state = avr_run(avr);
+    if(state == cpu_Done || state == cpu_Crashed){
+      fprintf(stderr, "memreport: simulation stopped (state %d)\n", state);
+      exit(2);
+    }
+  }
+}
+
+int main(int argc, char **argv){
+  if(argc < 3){
+    fprintf(stderr, "usage: memreport firmware.elf end [seconds]\n");
+    return 2;
+  }
+  unsigned end = strtoul(argv[2], NULL, 0) & 0xFFFF;
+  double seconds = argc > 3 ? atof(argv[3]) : 2.0;
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof(firmware));
+  if(elf_read_firmware(argv[1], &firmware)){
+    fprintf(stderr, "memreport: cannot load %s\n", argv[1]);
+    return 2;
+  }
+  avr_t *avr = avr_make_mcu_by_name("atmega2560");
+  if(!avr){
+    fprintf(stderr, "memreport: simavr has no atmega2560\n");
+    return 2;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = CPU_FREQ;
+  avr->vcc = avr->avcc = avr->aref = VCC_MV;
+
+  // Nothing pressed, internal clock (27 up), live tweaks on (31 up)
+  for(int bit = 0; bit < 8; bit++){
+    pin(avr, 'A', bit, 1);
+    pin(avr, 'C', bit, 1);
+  }
+  run(avr, seconds);
+
+  // Echo on as on the panel: two taps of 33 get to the delay mix, then 33
+  // held with pot 15 at half travel sets it to 128
+  for(int tap = 0; tap < 2; tap++){
+    pin(avr, 'C', 4, 0);
+    run(avr, 0.05);
+    pin(avr, 'C', 4, 1);
+    run(avr, 0.05);
+  }
+  pin(avr, 'C', 4, 0);
+  run(avr, 0.05);
+  pot(avr, 15, VCC_MV / 2 + 10);
+  run(avr, 0.05);
+  pin(avr, 'C', 4, 1);
+  run(avr, seconds);
+
+  unsigned top = avr->ramend;
+  unsigned p = end;
+  while(p <= top && avr->data[p] == STACK_CANARY){p++;}
+  unsigned ram = top + 1 - RAM_START;
+  unsigned stat = end - RAM_START;
+  unsigned stack = top + 1 - p;
+  printf("static %u bytes, stack peak %u bytes, never used %u of %u bytes\n",
+         stat, stack, p - end, ram);
+  return 0;
+}